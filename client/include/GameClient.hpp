@@ -1,32 +1,106 @@
 #include <iostream>
 #include <string>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <chrono>
 
 #include "rpc/client.h"
 #include "rpcMessages.hpp"
+#include "SnapshotDelta.hpp"
+#include "SocketStream.hpp"
+#include "DatagramSocket.hpp"
+#include "SharedMemoryRing.hpp"
 
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/ext.hpp>
 
+#define INPUT_HISTORY_SIZE                 256
+#define MAX_QUEUED_INPUT_SAMPLES           32
+#define INPUT_DATAGRAM_REDUNDANCY          8      // Input frames repeated in every datagram
+#define DATAGRAM_BASELINE_HISTORY          32     // Received ticks kept as baselines for datagram deltas
+#define DATAGRAM_HANDSHAKE_TIMEOUT_MS      1000
+#define SESSION_LOOP_CONNECT_TIMEOUT_MS    1000
+#define PLAYER_ABSENT_TIMEOUT_MILLISECONDS 1000
+
 class GameClient
 {
 private:
 
     std::unique_ptr<rpc::client> client;
+    std::unique_ptr<rpc::client> sessionClient;    // Connection to the event loop our session is pinned to
+    std::vector<std::string> methodNames;          // Name to call each rpcmsg::MethodID by
+    std::string ipAddress;
+    int portNumber;
     bool validPlayerSession = false;
-    uint32_t playerID;
+    uint32_t playerID = 0;
+    uint64_t sessionToken = 0;    // Proves the session is ours on the datagram channel and snapshot stream
+
+    // Latest game state received and the server tick it belongs to (baseline for the next delta)
+    rpcmsg::GameData gameData;
+    uint64_t gameDataTick = 0;
+    std::mutex gameDataLock;
+
+    // Stream the server pushes snapshots down once we are subscribed
+    std::unique_ptr<SocketStream> snapshotStream;
+    std::thread snapshotReceiverThread;
+    std::atomic<bool> snapshotStreamActive;
+
+    // Input sent so far and when, to time how long the server takes to act on it
+    uint32_t inputSequence = 0;
+    uint32_t acknowledgedInputSequence = 0;
+    std::array<std::chrono::steady_clock::time_point, INPUT_HISTORY_SIZE> inputSendTime;
+    std::chrono::steady_clock::time_point playerLastSeenTime;
+    std::atomic<int64_t> inputLatencyMicroseconds;
+
+    // Input samples taken since the last update was sent
+    std::vector<rpcmsg::InputFrame> queuedPlayerInput;
+
+    // UDP channel for input and snapshots, used instead of the RPC connection once open
+    std::unique_ptr<DatagramSocket> datagramSocket;
+    DatagramEndpoint serverEndpoint;
+    std::thread datagramReceiverThread;
+    std::atomic<bool> datagramChannelActive;
+    uint32_t datagramSnapshotRate = 0;
+    uint32_t datagramSnapshotByteBudget = 0;
+    std::deque<rpcmsg::InputFrame> recentInputFrames;
+    std::vector<std::pair<uint64_t, rpcmsg::GameData>> receivedGameData;
 
+    // Shared memory rings used instead of the network when the server runs on this host
+    std::unique_ptr<SnapshotRing> sharedSnapshots;
+    std::unique_ptr<InputRing> localInputRing;
+    std::thread sharedSnapshotReaderThread;
+    std::atomic<bool> sharedMemoryActive;
 
+    rpc::client & getSessionClient();
+    void negotiateMethodIDs();
+    void connectToSessionLoop();
+    void receiveSnapshots();
+    void readSharedSnapshots();
+    void closeSharedMemoryChannel();
+    void receiveDatagrams();
+    bool sendInputDatagram(const std::vector<rpcmsg::InputFrame> & inputFrames);
+    void closeDatagramChannel();
+    void handleGameDataUpdate();
 
 public:
     GameClient(std::string ipAddress, int portNumber);
     ~GameClient();
 
-    uint32_t registerNewPlayerSession(const rpcmsg::PlayerData & playerData);
-    bool updatePlayerData(const rpcmsg::PlayerData & playerData);
+    uint32_t registerNewPlayerSession(const rpcmsg::InputFrame & inputFrame);
+    void queuePlayerData(const rpcmsg::InputFrame & inputFrame);
+    bool updatePlayerData(const rpcmsg::InputFrame & inputFrame);
+    float negotiateSnapshotRate(uint32_t snapshotRate);
+    bool subscribeToSnapshots(uint32_t snapshotRate, uint32_t snapshotByteBudget);
+    bool openDatagramChannel(uint32_t snapshotRate, uint32_t snapshotByteBudget, float simulatedLoss);
+    bool openSharedMemoryChannel();
     rpcmsg::GameData syncGameState();
     rpc::client::connection_state getConnectionState();
+    int64_t getInputLatencyMicroseconds();
 
 
 };
@@ -2,6 +2,7 @@
 
 #include <chrono>
 #include <mutex>
+#include <atomic>
 #include <array>
 #include <queue>
 #include <cmath>
@@ -61,6 +62,11 @@
 #define MULTIPLIER_TEXT_COMBO_SIZE 4
 
 #define SYNC_RATE                  200
+#define INPUT_SAMPLES_PER_SEND     2       // Input is sampled every sync but sent every other one
+#define USE_DATAGRAM_CHANNEL       false   // Send input and receive snapshots over UDP
+#define SIMULATED_PACKET_LOSS      0.0f    // Fraction of input datagrams to drop on purpose
+#define SNAPSHOT_RATE              60      // Pushed snapshots a second, fit to the server's publish schedule
+#define SNAPSHOT_BYTE_BUDGET       0       // Bytes per pushed snapshot, 0 for no limit
 #define NANOSECONDS_IN_SECOND      1000000000
 
 #define GRAVITY                    -9.81
@@ -146,6 +152,7 @@ private:
     rpcmsg::GameData previousLocalGameData;   // Local game loop copy (no mutex needed)
     rpcmsg::GameData currentLocalGameData;    // Local game loop copy (no mutex needed)
     std::mutex incomingGameDataLock;
+    std::atomic<uint64_t> viewTimeMilliseconds;   // Server time of the game state being rendered
     uint32_t playerID;
     uint32_t playerTower;
     bool sessionActive;
@@ -179,7 +186,7 @@ private:
     void syncWithServer();
 
     // Helper functions
-    rpcmsg::PlayerData getOculusPlayerState();
+    rpcmsg::InputFrame getOculusInputFrame();
     void registerPlayer();
     std::vector<glm::mat4> getHandInformation();
     glm::mat4 getHeadInformation();
@@ -2,23 +2,113 @@
 
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <stdexcept>
 
-uint32_t GameClient::registerNewPlayerSession(const rpcmsg::PlayerData & playerData) {
+uint32_t GameClient::registerNewPlayerSession(const rpcmsg::InputFrame & inputFrame) {
     try {
-        this->playerID = this->client->call(rpcmsg::REQUEST_SERVER_SESSION, playerData).as<uint32_t>();
+        rpcmsg::InputFrame registrationData = inputFrame;
+        registrationData.inputSequence = 0;
+        rpcmsg::SessionGrant sessionGrant = this->client->call(
+            this->methodNames[rpcmsg::METHOD_REQUEST_SERVER_SESSION], registrationData).as<rpcmsg::SessionGrant>();
+        this->playerID = sessionGrant.playerID;
+        this->sessionToken = sessionGrant.sessionToken;
         this->validPlayerSession = true;
+
+        // Input numbering starts over with every session
+        std::lock_guard<std::mutex> lock(this->gameDataLock);
+        this->inputSequence = 0;
+        this->acknowledgedInputSequence = 0;
+        this->queuedPlayerInput.clear();
+        this->playerLastSeenTime = std::chrono::steady_clock::now();
     }
     catch (const std::exception&) {
         std::cerr << "Unable to register new player session" << std::endl;
         this->playerID = 0;
+        this->sessionToken = 0;
     }
 
+    if (this->playerID != 0)
+        this->connectToSessionLoop();
     return this->playerID;
 }
 
-bool GameClient::updatePlayerData(const rpcmsg::PlayerData & playerData) {
+// Move the rest of the session over to the server event loop it is pinned to, if the
+// server runs more than one. Stays on the main connection otherwise
+void GameClient::connectToSessionLoop() {
+    this->sessionClient.reset();
     try {
-        this->client->call(rpcmsg::UPDATE_PLAYER_DATA, this->playerID, playerData);
+        uint16_t loopPort = this->client->call(this->methodNames[rpcmsg::METHOD_GET_SESSION_LOOP_PORT], this->playerID).as<uint16_t>();
+        if (loopPort == 0)
+            return;
+
+        this->sessionClient = std::make_unique<rpc::client>(this->ipAddress, loopPort);
+        auto connectDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SESSION_LOOP_CONNECT_TIMEOUT_MS);
+        while ((this->sessionClient->get_connection_state() != rpc::client::connection_state::connected) &&
+            (std::chrono::steady_clock::now() < connectDeadline))
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (this->sessionClient->get_connection_state() != rpc::client::connection_state::connected)
+            throw std::runtime_error("Unable to connect to session event loop");
+    }
+    catch (const std::exception&) {
+        std::cerr << "Unable to move session to its server event loop" << std::endl;
+        this->sessionClient.reset();
+    }
+}
+
+rpc::client & GameClient::getSessionClient() {
+    if (this->sessionClient != nullptr)
+        return *this->sessionClient;
+    return *this->client;
+}
+
+// Hold on to an input sample until the next update is sent. The oldest samples are
+// dropped if updates stop going out
+void GameClient::queuePlayerData(const rpcmsg::InputFrame & inputFrame) {
+    std::lock_guard<std::mutex> lock(this->gameDataLock);
+    if (this->queuedPlayerInput.size() >= MAX_QUEUED_INPUT_SAMPLES)
+        this->queuedPlayerInput.erase(this->queuedPlayerInput.begin());
+    this->queuedPlayerInput.push_back(inputFrame);
+    this->queuedPlayerInput.back().inputSequence = ++this->inputSequence;
+}
+
+// Send every queued input sample along with the latest one, without waiting for the server.
+// Since nothing comes back, a lost session only shows by our player dropping out of the
+// game state. Returns false once that has been the case for too long
+bool GameClient::updatePlayerData(const rpcmsg::InputFrame & inputFrame) {
+    this->queuePlayerData(inputFrame);
+
+    std::vector<rpcmsg::InputFrame> playerInputSamples;
+    auto currentTime = std::chrono::steady_clock::now();
+    this->gameDataLock.lock();
+    playerInputSamples.swap(this->queuedPlayerInput);
+    for (auto sample = playerInputSamples.begin(); sample != playerInputSamples.end(); sample++)
+        this->inputSendTime[sample->inputSequence % INPUT_HISTORY_SIZE] = currentTime;
+    bool playerAbsent = (currentTime - this->playerLastSeenTime) > std::chrono::milliseconds(PLAYER_ABSENT_TIMEOUT_MILLISECONDS);
+    this->gameDataLock.unlock();
+
+    if (playerAbsent) {
+        std::cerr << "Player is no longer in the game" << std::endl;
+        return false;
+    }
+
+    if (this->sharedMemoryActive) {
+        for (auto sample = playerInputSamples.begin(); sample != playerInputSamples.end(); sample++) {
+            RPCLIB_MSGPACK::sbuffer buffer;
+            RPCLIB_MSGPACK::pack(buffer, *sample);
+            if (!this->localInputRing->push(buffer.data(), buffer.size())) {
+                std::cerr << "Local input ring is full" << std::endl;
+                break;
+            }
+        }
+        return true;
+    }
+
+    if (this->datagramChannelActive)
+        return this->sendInputDatagram(playerInputSamples);
+
+    try {
+        this->getSessionClient().send(this->methodNames[rpcmsg::METHOD_UPDATE_PLAYER_DATA], this->playerID, playerInputSamples);
         return true;
     }
     catch (const std::exception&) {
@@ -27,23 +117,342 @@ bool GameClient::updatePlayerData(const rpcmsg::PlayerData & playerData) {
     }
 }
 
+// Called with the game data lock held after our copy of the game state changed. Notes that
+// our player is still around and how long the server took to act on our latest input
+void GameClient::handleGameDataUpdate() {
+    auto player = this->gameData.playerData.find(this->playerID);
+    if (player == this->gameData.playerData.end())
+        return;
+
+    auto currentTime = std::chrono::steady_clock::now();
+    this->playerLastSeenTime = currentTime;
+    uint32_t acknowledged = player->second.inputSequence;
+    if ((acknowledged > this->acknowledgedInputSequence) && (acknowledged <= this->inputSequence)) {
+        if (this->inputSequence - acknowledged < INPUT_HISTORY_SIZE)
+            this->inputLatencyMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                currentTime - this->inputSendTime[acknowledged % INPUT_HISTORY_SIZE]).count();
+        this->acknowledgedInputSequence = acknowledged;
+    }
+}
+
+// Time between sending an input and first seeing it reflected in the game state
+int64_t GameClient::getInputLatencyMicroseconds() {
+    return this->inputLatencyMicroseconds;
+}
+
+
+// Settle with the server on how often it pushes snapshots to us, on any channel. Returns
+// the rate it will actually use, which lines up with its publish schedule, or 0 if it
+// won't say
+float GameClient::negotiateSnapshotRate(uint32_t snapshotRate) {
+    if (this->playerID == 0)
+        return 0.0f;
+
+    try {
+        rpcmsg::SnapshotSchedule snapshotSchedule = this->getSessionClient().call(
+            this->methodNames[rpcmsg::METHOD_NEGOTIATE_SNAPSHOT_RATE], this->playerID, snapshotRate).as<rpcmsg::SnapshotSchedule>();
+        if (snapshotSchedule.tickInterval == 0)
+            return 0.0f;
+        return (float)snapshotSchedule.publishRate / (float)snapshotSchedule.tickInterval;
+    }
+    catch (const std::exception&) {
+        std::cerr << "Unable to negotiate snapshot rate" << std::endl;
+        return 0.0f;
+    }
+}
+
+// Ask the server to push snapshots to us instead of us polling for them, each kept within
+// the byte budget (0 for no limit). The player has to be registered first, and a stream
+// left over from an earlier session is dropped. Returns false if the server doesn't offer
+// the stream
+bool GameClient::subscribeToSnapshots(uint32_t snapshotRate, uint32_t snapshotByteBudget) {
+    if (this->playerID == 0)
+        return false;
+
+    if (this->snapshotStream != nullptr)
+        this->snapshotStream->close();
+    if (this->snapshotReceiverThread.joinable())
+        this->snapshotReceiverThread.join();
+    this->snapshotStream = std::make_unique<SocketStream>();
+    if (!this->snapshotStream->connect(this->ipAddress, this->portNumber + SNAPSHOT_STREAM_PORT_OFFSET)) {
+        std::cerr << "Unable to open snapshot stream. Polling for game state instead" << std::endl;
+        return false;
+    }
+
+    rpcmsg::SnapshotSubscription subscription = { this->playerID, snapshotRate, snapshotByteBudget, this->sessionToken };
+    RPCLIB_MSGPACK::sbuffer buffer;
+    RPCLIB_MSGPACK::pack(buffer, subscription);
+    if (!this->snapshotStream->sendFrame(buffer.data(), buffer.size())) {
+        std::cerr << "Unable to subscribe to snapshots. Polling for game state instead" << std::endl;
+        this->snapshotStream->close();
+        return false;
+    }
+
+    this->snapshotStreamActive = true;
+    this->snapshotReceiverThread = std::thread(&GameClient::receiveSnapshots, this);
+    return true;
+}
+
+// Apply each snapshot the server pushes as it arrives. Falls back to polling once the
+// stream closes
+void GameClient::receiveSnapshots() {
+    std::vector<char> frame;
+    while (this->snapshotStream->receiveFrame(frame)) {
+        rpcmsg::GameDataDelta gameDataDelta;
+        rpcmsg::StreamControl streamControl = { 0 };
+        try {
+            RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(frame.data(), frame.size());
+            if (oh.get().type == RPCLIB_MSGPACK::type::MAP)
+                oh.get().convert(streamControl);
+            else
+                oh.get().convert(gameDataDelta);
+        }
+        catch (const std::exception&) {
+            break;
+        }
+
+        // The server closed our session. Nothing more is coming
+        if (streamControl.code == STREAM_CONTROL_SESSION_CLOSED) {
+            std::cerr << "Server closed the player session" << std::endl;
+            break;
+        }
+        if (streamControl.code != 0)
+            continue;
+
+        std::lock_guard<std::mutex> lock(this->gameDataLock);
+        if ((gameDataDelta.baselineTick == 0) || (gameDataDelta.baselineTick == this->gameDataTick)) {
+            rpcmsg::applyGameDataDelta(gameDataDelta, this->gameData);
+            this->gameDataTick = gameDataDelta.tick;
+            this->handleGameDataUpdate();
+        }
+    }
+
+    this->snapshotStream->close();
+    this->snapshotStreamActive = false;
+}
+
+// Read snapshots and write input through shared memory when the server runs on this host.
+// The player has to be registered first. Returns false if the server isn't local
+bool GameClient::openSharedMemoryChannel() {
+    if ((this->playerID == 0) || ((this->ipAddress != "127.0.0.1") && (this->ipAddress != "localhost")))
+        return false;
+
+    this->closeSharedMemoryChannel();
+    this->sharedSnapshots = std::make_unique<SnapshotRing>();
+    this->localInputRing = std::make_unique<InputRing>();
+    try {
+        std::string inputRingName = this->getSessionClient().call(this->methodNames[rpcmsg::METHOD_OPEN_LOCAL_INPUT],
+            this->playerID, this->sessionToken).as<std::string>();
+        if ((!this->sharedSnapshots->open(getSnapshotRingName(this->portNumber))) || (!this->localInputRing->open(inputRingName)))
+            throw std::runtime_error("Unable to open shared memory rings");
+    }
+    catch (const std::exception&) {
+        std::cerr << "Unable to use shared memory with the server" << std::endl;
+        this->closeSharedMemoryChannel();
+        return false;
+    }
+
+    this->sharedMemoryActive = true;
+    this->sharedSnapshotReaderThread = std::thread(&GameClient::readSharedSnapshots, this);
+    return true;
+}
+
+void GameClient::closeSharedMemoryChannel() {
+    this->sharedMemoryActive = false;
+    if (this->sharedSnapshotReaderThread.joinable())
+        this->sharedSnapshotReaderThread.join();
+    if (this->sharedSnapshots != nullptr)
+        this->sharedSnapshots->close();
+    if (this->localInputRing != nullptr)
+        this->localInputRing->close();
+}
+
+// Pick up the newest snapshot in shared memory whenever there is one, unpacking it right
+// where it lies. An unpack that got overwritten halfway is thrown away
+void GameClient::readSharedSnapshots() {
+    while (this->sharedMemoryActive) {
+        rpcmsg::GameData newGameData;
+        bool unpacked = false;
+        bool consistent = this->sharedSnapshots->readLatest([&newGameData, &unpacked](const char * data, size_t size) {
+            try {
+                RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(data, size);
+                oh.get().convert(newGameData);
+                unpacked = true;
+            }
+            catch (const std::exception&) {
+            }
+        });
+
+        if (consistent && unpacked) {
+            std::lock_guard<std::mutex> lock(this->gameDataLock);
+            if (newGameData.tick > this->gameDataTick) {
+                this->gameData = std::move(newGameData);
+                this->gameDataTick = this->gameData.tick;
+                this->handleGameDataUpdate();
+            }
+        }
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// Switch input and snapshots over to datagrams that may get lost instead of waiting on
+// each other on the RPC connection. The player has to be registered first. Returns false
+// if the server doesn't answer on the channel
+bool GameClient::openDatagramChannel(uint32_t snapshotRate, uint32_t snapshotByteBudget, float simulatedLoss) {
+    if (this->playerID == 0)
+        return false;
+
+    this->closeDatagramChannel();
+    this->datagramSocket = std::make_unique<DatagramSocket>();
+    this->datagramSocket->setSimulatedLoss(simulatedLoss);
+    if ((!DatagramSocket::resolve(this->ipAddress, this->portNumber + DATAGRAM_PORT_OFFSET, this->serverEndpoint)) ||
+        (!this->datagramSocket->open(0))) {
+        std::cerr << "Unable to open datagram channel" << std::endl;
+        return false;
+    }
+
+    this->gameDataLock.lock();
+    this->datagramSnapshotRate = snapshotRate;
+    this->datagramSnapshotByteBudget = snapshotByteBudget;
+    this->recentInputFrames.clear();
+    this->receivedGameData.assign(DATAGRAM_BASELINE_HISTORY, std::make_pair((uint64_t)0, rpcmsg::GameData()));
+    uint64_t startingTick = this->gameDataTick;
+    this->gameDataLock.unlock();
+
+    this->datagramChannelActive = true;
+    this->datagramReceiverThread = std::thread(&GameClient::receiveDatagrams, this);
+
+    // Keep knocking until the first snapshot datagram comes back
+    auto startTime = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - startTime < std::chrono::milliseconds(DATAGRAM_HANDSHAKE_TIMEOUT_MS)) {
+        this->sendInputDatagram(std::vector<rpcmsg::InputFrame>());
+        std::this_thread::sleep_for(std::chrono::milliseconds(DATAGRAM_HANDSHAKE_TIMEOUT_MS / 10));
+        std::lock_guard<std::mutex> lock(this->gameDataLock);
+        if (this->gameDataTick != startingTick)
+            return true;
+    }
+
+    std::cerr << "No answer on datagram channel" << std::endl;
+    this->closeDatagramChannel();
+    return false;
+}
+
+void GameClient::closeDatagramChannel() {
+    this->datagramChannelActive = false;
+    if (this->datagramReceiverThread.joinable())
+        this->datagramReceiverThread.join();
+    if (this->datagramSocket != nullptr)
+        this->datagramSocket->close();
+}
+
+// Send the given input frames along with the most recent ones sent before, so the server
+// still gets them if some datagrams are lost
+bool GameClient::sendInputDatagram(const std::vector<rpcmsg::InputFrame> & inputFrames) {
+    rpcmsg::InputDatagram inputDatagram;
+    this->gameDataLock.lock();
+    this->recentInputFrames.insert(this->recentInputFrames.end(), inputFrames.begin(), inputFrames.end());
+    while (this->recentInputFrames.size() > std::max((size_t)INPUT_DATAGRAM_REDUNDANCY, inputFrames.size()))
+        this->recentInputFrames.pop_front();
+    inputDatagram.playerID = this->playerID;
+    inputDatagram.sessionToken = this->sessionToken;
+    inputDatagram.acknowledgedTick = this->gameDataTick;
+    inputDatagram.snapshotRate = this->datagramSnapshotRate;
+    inputDatagram.snapshotByteBudget = this->datagramSnapshotByteBudget;
+    inputDatagram.inputFrames.assign(this->recentInputFrames.begin(), this->recentInputFrames.end());
+    this->gameDataLock.unlock();
+
+    RPCLIB_MSGPACK::sbuffer buffer;
+    RPCLIB_MSGPACK::pack(buffer, inputDatagram);
+    if (!this->datagramSocket->sendTo(this->serverEndpoint, buffer.data(), buffer.size())) {
+        std::cerr << "Unable to send input datagram" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Apply snapshot datagrams as they come in. Late and duplicate ones are ignored, and a
+// delta can be made against any recently received tick, not just the latest one
+void GameClient::receiveDatagrams() {
+    std::vector<char> datagram;
+    DatagramEndpoint endpoint;
+    while (this->datagramChannelActive) {
+        if ((!this->datagramSocket->receiveFrom(datagram, endpoint)) || (endpoint != this->serverEndpoint))
+            continue;
+
+        rpcmsg::GameDataDelta gameDataDelta;
+        try {
+            RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(datagram.data(), datagram.size());
+            oh.get().convert(gameDataDelta);
+        }
+        catch (const std::exception&) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(this->gameDataLock);
+        if (gameDataDelta.tick <= this->gameDataTick)
+            continue;
+
+        rpcmsg::GameData updatedGameData;
+        if (gameDataDelta.baselineTick == this->gameDataTick)
+            updatedGameData = this->gameData;
+        else if (gameDataDelta.baselineTick != 0) {
+            std::pair<uint64_t, rpcmsg::GameData> & baseline = this->receivedGameData[gameDataDelta.baselineTick % DATAGRAM_BASELINE_HISTORY];
+            if (baseline.first != gameDataDelta.baselineTick)
+                continue;
+            updatedGameData = baseline.second;
+        }
+
+        rpcmsg::applyGameDataDelta(gameDataDelta, updatedGameData);
+        this->gameData = updatedGameData;
+        this->gameDataTick = gameDataDelta.tick;
+        this->receivedGameData[gameDataDelta.tick % DATAGRAM_BASELINE_HISTORY] = std::make_pair(gameDataDelta.tick, updatedGameData);
+        this->handleGameDataUpdate();
+    }
+}
 
 rpcmsg::GameData GameClient::syncGameState() {
-    std::vector<char> raw_data = this->client->call(rpcmsg::GET_GAME_DATA).as<std::vector<char>>();
-    
-    RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(raw_data.data(), raw_data.size());
+
+    // The server keeps our copy up to date when we are subscribed
+    if (this->snapshotStreamActive || this->datagramChannelActive || this->sharedMemoryActive) {
+        std::lock_guard<std::mutex> lock(this->gameDataLock);
+        return this->gameData;
+    }
+
+    RPCLIB_MSGPACK::object_handle response = this->getSessionClient().call(this->methodNames[rpcmsg::METHOD_GET_GAME_DATA_DELTA], this->playerID, this->gameDataTick);
+    const RPCLIB_MSGPACK::object & raw_data = response.get();
+    if (raw_data.type != RPCLIB_MSGPACK::type::BIN)
+        throw RPCLIB_MSGPACK::type_error();
+
+    // Unpack the game data right out of the response instead of copying the bytes out first
+    RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(raw_data.via.bin.ptr, raw_data.via.bin.size);
     RPCLIB_MSGPACK::object obj = oh.get();
-    //std::cout << raw_data.size() << std::endl;
+    //std::cout << raw_data.via.bin.size << std::endl;
     //std::cout << obj << std::endl;
 
-    rpcmsg::GameData gameData;
-    obj.convert(gameData);
+    rpcmsg::GameDataDelta gameDataDelta;
+    obj.convert(gameDataDelta);
 
-    return gameData;
+    // Bring our copy up to date. The delta is made against the tick we asked for, or is a full snapshot
+    std::lock_guard<std::mutex> lock(this->gameDataLock);
+    if ((gameDataDelta.baselineTick == 0) || (gameDataDelta.baselineTick == this->gameDataTick)) {
+        rpcmsg::applyGameDataDelta(gameDataDelta, this->gameData);
+        this->gameDataTick = gameDataDelta.tick;
+        this->handleGameDataUpdate();
+    }
+
+    return this->gameData;
 }
 
 GameClient::GameClient(std::string ipAddress, int portNumber)
 {
+    this->ipAddress = ipAddress;
+    this->portNumber = portNumber;
+    this->snapshotStreamActive = false;
+    this->datagramChannelActive = false;
+    this->sharedMemoryActive = false;
+    this->inputLatencyMicroseconds = 0;
+
     // Attempt to connect to the specified server
     std::cout << "Attempting to connect to " << ipAddress << ":" << portNumber << "..." << std::endl;
     this->client = std::make_unique<rpc::client>(ipAddress, portNumber);
@@ -60,6 +469,24 @@ GameClient::GameClient(std::string ipAddress, int portNumber)
     }
 
     std::cout << "\tSuccessfully connected to server." << std::endl;
+    this->negotiateMethodIDs();
+}
+
+// Look up the server's IDs for the procedures we call, so every call after this one goes
+// out under the compact name. Servers that don't hand out IDs are called by full name
+void GameClient::negotiateMethodIDs() {
+    this->methodNames.assign(rpcmsg::METHOD_NAMES, rpcmsg::METHOD_NAMES + rpcmsg::METHOD_COUNT);
+    try {
+        auto methodIDs = this->client->call(rpcmsg::GET_METHOD_IDS).as<std::unordered_map<std::string, uint32_t>>();
+        for (uint32_t methodID = 0; methodID < rpcmsg::METHOD_COUNT; methodID++) {
+            auto serverMethodID = methodIDs.find(rpcmsg::METHOD_NAMES[methodID]);
+            if (serverMethodID != methodIDs.end())
+                this->methodNames[methodID] = rpcmsg::getCompactMethodName(serverMethodID->second);
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "\tServer doesn't support method IDs. Calling by name" << std::endl;
+    }
 }
 
 rpc::client::connection_state GameClient::getConnectionState() {
@@ -69,6 +496,13 @@ rpc::client::connection_state GameClient::getConnectionState() {
 
 GameClient::~GameClient()
 {
+    if (this->snapshotStream != nullptr)
+        this->snapshotStream->close();
+    if (this->snapshotReceiverThread.joinable())
+        this->snapshotReceiverThread.join();
+    this->closeDatagramChannel();
+    this->closeSharedMemoryChannel();
+
     if (this->validPlayerSession && (this->client->get_connection_state() == rpc::client::connection_state::connected))
-        this->client->call(rpcmsg::CLOSE_SERVER_SESSION, this->playerID);
+        this->client->call(this->methodNames[rpcmsg::METHOD_CLOSE_SERVER_SESSION], this->playerID);
 }
\ No newline at end of file
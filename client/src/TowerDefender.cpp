@@ -17,6 +17,7 @@ TowerDefender::TowerDefender(std::string ipAddress, int portNumber)
     this->sessionActive = true;
     this->playerID = 0;
     this->playerTower = 0;
+    this->viewTimeMilliseconds = 0;
 
     // Create new background thread to sync with server
     std::thread syncServerThread = std::thread(&TowerDefender::syncWithServer, this);
@@ -124,6 +125,7 @@ void TowerDefender::update()
 
     // Update the game data
     this->previousLocalGameData = this->currentLocalGameData;
+    this->viewTimeMilliseconds = this->currentLocalGameData.gameState.serverTimeMilliseconds;
 
     // Store debug information
     auto currentTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
@@ -145,12 +147,18 @@ void TowerDefender::syncWithServer()
     std::chrono::nanoseconds sleepDuration = std::chrono::nanoseconds(NANOSECONDS_IN_SECOND / SYNC_RATE);
 
     // Continue to update while connection is alive
+    uint64_t inputSampleCount = 0;
     while ((this->sessionActive) && (this->gameClient->getConnectionState() == rpc::client::connection_state::connected)) 
     {
-        // Request update from server and keep track of total time it took
+        // Request update from server and keep track of total time it took. Input is sampled
+        // every time around but only sent in batches
         auto start = std::chrono::high_resolution_clock::now();
         if (this->playerID != 0) {
-            bool successful = this->gameClient->updatePlayerData(this->getOculusPlayerState());
+            bool successful = true;
+            if (++inputSampleCount % INPUT_SAMPLES_PER_SEND == 0)
+                successful = this->gameClient->updatePlayerData(this->getOculusInputFrame());
+            else
+                this->gameClient->queuePlayerData(this->getOculusInputFrame());
             auto updatedGameData = this->gameClient->syncGameState();
             this->incomingGameDataLock.lock();
             this->incomingGameData = updatedGameData;
@@ -167,28 +175,31 @@ void TowerDefender::syncWithServer()
     }
 }
 
-rpcmsg::PlayerData TowerDefender::getOculusPlayerState()
+rpcmsg::InputFrame TowerDefender::getOculusInputFrame()
 {
     // Create data about the user
-    rpcmsg::PlayerData playerData;
-    playerData.headData.headPose = rpcmsg::glmToRPC(this->getHeadInformation());
+    rpcmsg::InputFrame inputFrame = rpcmsg::InputFrame();
+    inputFrame.headPose = rpcmsg::glmToRPC(this->getHeadInformation());
+    inputFrame.viewTimeMilliseconds = this->viewTimeMilliseconds;
+    inputFrame.sampleTimeMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
 
     // Fill out data on each hand
     auto playerHandData = this->getHandInformation();
     ovrInputState inputState;
     if (OVR_SUCCESS(ovr_GetInputState(_session, ovrControllerType_Touch, &inputState)))
     {
+        inputFrame.buttonState = inputState.Buttons;
         for (int handType = 0; handType < 2; handType++) {
-            playerData.handData[handType].handPose = rpcmsg::glmToRPC(playerHandData[handType]);
-            playerData.handData[handType].thumbstickValue.x = inputState.Thumbstick[handType].x;
-            playerData.handData[handType].thumbstickValue.y = inputState.Thumbstick[handType].y;
-            playerData.handData[handType].buttonState = inputState.Buttons;
-            playerData.handData[handType].indexTriggerValue = inputState.IndexTrigger[handType];
-            playerData.handData[handType].handTriggerValue = inputState.HandTrigger[handType];
+            inputFrame.handPose[handType] = rpcmsg::glmToRPC(playerHandData[handType]);
+            inputFrame.thumbstickValue[handType].x = inputState.Thumbstick[handType].x;
+            inputFrame.thumbstickValue[handType].y = inputState.Thumbstick[handType].y;
+            inputFrame.indexTriggerValue[handType] = inputState.IndexTrigger[handType];
+            inputFrame.handTriggerValue[handType] = inputState.HandTrigger[handType];
         }
     }
 
-    return playerData;
+    return inputFrame;
 }
 
 
@@ -196,23 +207,27 @@ void TowerDefender::registerPlayer()
 {
     // Initialize player data
     std::cout << "Attempting to register player..." << std::endl;
-    rpcmsg::PlayerData playerData = this->getOculusPlayerState();
-    playerData.arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f)));
-    playerData.dominantHand = RIGHT_HAND;
-    playerData.arrowReleased = true;
-    playerData.arrowReadying = false;
-    playerData.arrowFiringAudioCue = 0;
-    playerData.arrowStretchingAudioCue = 0;
-    this->playerID = this->gameClient->registerNewPlayerSession(playerData);
+    rpcmsg::InputFrame inputFrame = this->getOculusInputFrame();
+    this->playerID = this->gameClient->registerNewPlayerSession(inputFrame);
 
     // If server does not accept new player at the moment, keep trying
     while (this->playerID == 0) {
         std::cout << "\tServer is full. Retrying..." << std::endl;
         std::this_thread::sleep_for(std::chrono::seconds(5));
-        this->playerID = this->gameClient->registerNewPlayerSession(playerData);
+        this->playerID = this->gameClient->registerNewPlayerSession(inputFrame);
     }
 
     std::cout << "\tSuccessfully registered as playerID: " << this->playerID << std::endl;
+
+    // Have the server push game state to us rather than asking for it every sync. Shared
+    // memory is used when the server runs on this machine
+    if (this->gameClient->openSharedMemoryChannel())
+        return;
+    float snapshotRate = this->gameClient->negotiateSnapshotRate(SNAPSHOT_RATE);
+    if (snapshotRate > 0.0f)
+        std::cout << "\tReceiving snapshots at " << snapshotRate << " Hz" << std::endl;
+    if ((!USE_DATAGRAM_CHANNEL) || (!this->gameClient->openDatagramChannel(SNAPSHOT_RATE, SNAPSHOT_BYTE_BUDGET, SIMULATED_PACKET_LOSS)))
+        this->gameClient->subscribeToSnapshots(SNAPSHOT_RATE, SNAPSHOT_BYTE_BUDGET);
 }
 
 void TowerDefender::handleAudioUpdate(rpcmsg::GameData & currentGameData,
@@ -357,7 +372,8 @@ void TowerDefender::renderCastleCrashers(const glm::mat4 & projection, const glm
         castleCrasher != gameDataInstance.gameState.castleCrasherData.end(); castleCrasher++) {
 
         // Calculate the rotation of the legs/arms
-        float rotationAngle = (castleCrasher->animationCycle <= 180.0f) ? castleCrasher->animationCycle : (360.0f - castleCrasher->animationCycle);
+        float animationCycle = rpcmsg::getAnimationCycle(*castleCrasher, gameDataInstance.gameState.serverTimeMilliseconds);
+        float rotationAngle = (animationCycle <= 180.0f) ? animationCycle : (360.0f - animationCycle);
         float leftArmRotation = rotationAngle / 1.5f - 60.0f;
         float rightArmRotation = rotationAngle / -1.5f - 60.0f;
         float leftLegRotation = rotationAngle / 1.5f - 60.0f;
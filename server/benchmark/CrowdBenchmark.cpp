@@ -0,0 +1,243 @@
+// Times castle crasher updates for growing horde sizes and checks them against the engine's
+// tick budget: the movement stage on its own (neighborhood grid + CrowdSimulation::update) and
+// a full GameEngine::updateProcedure tick, which adds the game data copies, the arrow hit test
+// and the lag compensation history on top. Exits with 1 when the per castle crasher cost stops
+// scaling linearly or HORDE_MAX_CASTLE_CRASHERS no longer fits the budget.
+//
+// Built by CrowdBenchmark.vcxproj in the server solution. Outside Visual Studio, from this folder:
+//
+//   g++ -O2 -std=c++14 -pthread -I../include -I../../shared/include -I../../shared/include/LibOVR
+//       CrowdBenchmark.cpp ../src/GameEngine.cpp ../src/CrowdSimulation.cpp ../src/FlowField.cpp
+//       ../src/NeighborhoodGrid.cpp ../src/EntityHistory.cpp ../src/TimingWheel.cpp
+//       ../../shared/src/rpcMessages.cpp ../../shared/src/SnapshotDelta.cpp -o CrowdBenchmark
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <algorithm>
+
+#include "GameEngine.hpp"
+#include "CrowdSimulation.hpp"
+#include "NeighborhoodGrid.hpp"
+
+#define BENCHMARK_FIRST_TICK         1
+#define BENCHMARK_WARMUP_TICKS       64
+#define BENCHMARK_TICKS              (4 * REFRESH_RATE)
+#define BENCHMARK_FULL_TICKS         REFRESH_RATE
+#define BENCHMARK_PLAYERS            2
+#define BENCHMARK_FLYING_ARROWS      16
+#define BENCHMARK_ARROW_HEIGHT       1000.0f    // High enough to never land or hit anything during the run
+#define BENCHMARK_LAG_MILLISECONDS   100
+#define BENCHMARK_MAX_SCALING_RATIO  3.0        // Per castle crasher cost, largest horde vs smallest (10x if quadratic)
+
+static const std::vector<int> HORDE_SIZES = { 1000, 2000, HORDE_MAX_CASTLE_CRASHERS, 5000, 10000 };
+
+struct StageTiming {
+    double meanMilliseconds;
+    double p99Milliseconds;
+    double maxMilliseconds;
+};
+
+class GameEngineBenchmark
+{
+public:
+
+    // Scatter castle crashers between the spawn area and the middle of the map, the way a horde
+    // looks once it has spread out. Nobody starts close enough to reach the chest during a run
+    static std::list<rpcmsg::CastleCrasherData> spawnHorde(int hordeSize, std::mt19937_64 & randomGenerator)
+    {
+        std::uniform_real_distribution<float> positionX(CASTLE_CRASHER_MIN_X, CASTLE_CRASHER_MAX_X);
+        std::uniform_real_distribution<float> positionZ(CASTLE_CRASHER_MIN_Z, 0.0f);
+        std::uniform_real_distribution<float> endPositionX(CHEST_MIN_X, CHEST_MAX_X);
+
+        std::list<rpcmsg::CastleCrasherData> castleCrashers;
+        for (int entityID = 1; entityID <= hordeSize; entityID++) {
+            rpcmsg::CastleCrasherData castleCrasher = {};
+            castleCrasher.entityID = entityID;
+            castleCrasher.alive = true;
+            castleCrasher.health = 100.0f;
+            castleCrasher.direction = rpcmsg::glmToRPC(glm::vec3(0.0f, 0.0f, 1.0f));
+            glm::vec2 groundPosition = glm::vec2(positionX(randomGenerator), positionZ(randomGenerator));
+            castleCrasher.position = rpcmsg::glmToRPC(glm::vec3(groundPosition.x,
+                GameEngine::calculateTerrainHeight(groundPosition), groundPosition.y));
+            castleCrasher.endPosition = rpcmsg::glmToRPC(glm::vec3(endPositionX(randomGenerator), 0.5f, CHEST_Z));
+            castleCrashers.push_back(castleCrasher);
+        }
+        return castleCrashers;
+    }
+
+    static StageTiming summarize(const char * stage, int hordeSize, std::vector<double> & tickMilliseconds)
+    {
+        double total = 0.0;
+        for (auto tick = tickMilliseconds.begin(); tick != tickMilliseconds.end(); tick++)
+            total += *tick;
+        std::sort(tickMilliseconds.begin(), tickMilliseconds.end());
+
+        StageTiming timing;
+        timing.meanMilliseconds = total / tickMilliseconds.size();
+        timing.p99Milliseconds = tickMilliseconds[tickMilliseconds.size() * 99 / 100];
+        timing.maxMilliseconds = tickMilliseconds.back();
+        std::cout << std::setw(18) << stage << std::setw(8) << hordeSize << std::fixed << std::setprecision(3)
+            << std::setw(12) << timing.meanMilliseconds << std::setw(12) << timing.p99Milliseconds
+            << std::setw(12) << timing.maxMilliseconds << std::endl;
+        return timing;
+    }
+
+    // Neighborhood grid on its own: rebuild, then one separation query per castle crasher
+    static StageTiming timeNeighborhoodGrid(const std::list<rpcmsg::CastleCrasherData> & castleCrashers)
+    {
+        std::vector<glm::vec3> positions;
+        for (auto castleCrasher = castleCrashers.begin(); castleCrasher != castleCrashers.end(); castleCrasher++)
+            positions.push_back(rpcmsg::rpcToGLM(castleCrasher->position));
+        NeighborhoodGrid neighborhoodGrid(glm::vec2(CASTLE_CRASHER_MIN_X, CASTLE_CRASHER_MIN_Z),
+            glm::vec2(CASTLE_CRASHER_MAX_X, CASTLE_CRASHER_MAX_Z), SEPARATION_RADIUS);
+        std::vector<uint32_t> neighbors;
+        std::vector<double> tickMilliseconds;
+        size_t neighborCount = 0;
+        for (int tick = 0; tick < BENCHMARK_TICKS; tick++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            neighborhoodGrid.build(positions);
+            for (auto position = positions.begin(); position != positions.end(); position++) {
+                neighborhoodGrid.findNeighbors(*position, SEPARATION_RADIUS, neighbors);
+                neighborCount += neighbors.size();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            tickMilliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        // Keeps the neighbor queries from being optimized away
+        if (neighborCount == 0)
+            std::cout << "No neighbors found" << std::endl;
+        return summarize("NeighborhoodGrid", (int)positions.size(), tickMilliseconds);
+    }
+
+    // Whole movement stage, including the simulation rate of distant castle crashers
+    static StageTiming timeCrowdSimulation(std::list<rpcmsg::CastleCrasherData> castleCrashers)
+    {
+        // Chest and two players standing by the notification screens
+        std::vector<glm::vec2> pointsOfInterest = {
+            glm::vec2((CHEST_MIN_X + CHEST_MAX_X) / 2.0f, (float)CHEST_Z),
+            glm::vec2(NOTIFICATION_SCREEN_LOCATION[0].x, NOTIFICATION_SCREEN_LOCATION[0].z),
+            glm::vec2(NOTIFICATION_SCREEN_LOCATION[1].x, NOTIFICATION_SCREEN_LOCATION[1].z),
+        };
+
+        int hordeSize = (int)castleCrashers.size();
+        CrowdSimulation crowdSimulation(GameEngine::calculateTerrainHeight);
+        std::vector<uint32_t> arrivedEntityIDs;
+        std::vector<double> tickMilliseconds;
+        for (uint64_t tick = BENCHMARK_FIRST_TICK; tick < BENCHMARK_FIRST_TICK + BENCHMARK_WARMUP_TICKS + BENCHMARK_TICKS; tick++) {
+            arrivedEntityIDs.clear();
+            auto start = std::chrono::high_resolution_clock::now();
+            crowdSimulation.update(castleCrashers, tick, pointsOfInterest, arrivedEntityIDs);
+            auto end = std::chrono::high_resolution_clock::now();
+            if (tick >= BENCHMARK_FIRST_TICK + BENCHMARK_WARMUP_TICKS)
+                tickMilliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return summarize("CrowdSimulation", hordeSize, tickMilliseconds);
+    }
+
+    // A full engine tick for a started game: two players by the notification screens and arrows
+    // in flight, so the hit test and lag compensation lookup run against the whole horde
+    static StageTiming timeFullTick(const std::list<rpcmsg::CastleCrasherData> & castleCrashers)
+    {
+        GameEngine gameEngine(false, false);
+        gameEngine.gameData.gameState.gameStarted = true;
+        gameEngine.gameData.gameState.castleHealth = 100.0f;
+        gameEngine.gameData.gameState.castleCrasherData = castleCrashers;
+        gameEngine.nextEntityID = (uint32_t)castleCrashers.size() + 1;
+
+        for (uint32_t playerID = 0; playerID < BENCHMARK_PLAYERS; playerID++) {
+            rpcmsg::InputFrame inputFrame = {};
+            glm::mat4 headPose = glm::translate(glm::mat4(1.0f), NOTIFICATION_SCREEN_LOCATION[playerID]);
+            inputFrame.headPose = rpcmsg::glmToRPC(headPose);
+            inputFrame.handPose[0] = rpcmsg::glmToRPC(headPose);
+            inputFrame.handPose[1] = rpcmsg::glmToRPC(headPose);
+            gameEngine.addUser(playerID);
+            gameEngine.handleNewUserInput(playerID, inputFrame);
+        }
+
+        for (int arrowIndex = 0; arrowIndex < BENCHMARK_FLYING_ARROWS; arrowIndex++) {
+            rpcmsg::ArrowData arrow = {};
+            glm::vec3 initPosition = glm::vec3((float)arrowIndex, BENCHMARK_ARROW_HEIGHT, 0.0f);
+            arrow.entityID = gameEngine.nextEntityID++;
+            arrow.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), initPosition));
+            arrow.launchTimeMilliseconds = gameEngine.getCurrentTimeMilliseconds();
+            arrow.lagCompensationMilliseconds = BENCHMARK_LAG_MILLISECONDS;
+            arrow.initPosition = rpcmsg::glmToRPC(initPosition);
+            arrow.position = arrow.initPosition;
+            gameEngine.gameData.gameState.flyingArrows.push_back(arrow);
+        }
+
+        std::vector<double> tickMilliseconds;
+        for (int tick = 0; tick < BENCHMARK_WARMUP_TICKS + BENCHMARK_FULL_TICKS; tick++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            gameEngine.updateProcedure();
+            auto end = std::chrono::high_resolution_clock::now();
+            if (tick >= BENCHMARK_WARMUP_TICKS)
+                tickMilliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return summarize("updateProcedure", (int)castleCrashers.size(), tickMilliseconds);
+    }
+
+    // Per castle crasher cost of the largest horde over that of the smallest one
+    static bool checkScaling(const char * stage, const std::vector<StageTiming> & timings)
+    {
+        double smallest = timings.front().meanMilliseconds / HORDE_SIZES.front();
+        double largest = timings.back().meanMilliseconds / HORDE_SIZES.back();
+        double scalingRatio = largest / smallest;
+        bool linear = (scalingRatio <= BENCHMARK_MAX_SCALING_RATIO);
+        std::cout << std::setw(18) << stage << "  " << std::fixed << std::setprecision(2) << scalingRatio
+            << "x per castle crasher from " << HORDE_SIZES.front() << " to " << HORDE_SIZES.back()
+            << (linear ? "" : "  (not linear)") << std::endl;
+        return linear;
+    }
+};
+
+int main()
+{
+    std::mt19937_64 randomGenerator(REFRESH_RATE);
+    double tickBudgetMilliseconds = (double)MILLISECONDS_IN_SECOND / REFRESH_RATE;
+    std::cout << "Tick budget: " << tickBudgetMilliseconds << " ms (" << REFRESH_RATE << " Hz)" << std::endl;
+    std::cout << std::setw(18) << "stage" << std::setw(8) << "count" << std::setw(12) << "mean ms"
+        << std::setw(12) << "p99 ms" << std::setw(12) << "max ms" << std::endl;
+
+    std::vector<StageTiming> gridTimings, crowdTimings, fullTickTimings;
+    for (auto hordeSize = HORDE_SIZES.begin(); hordeSize != HORDE_SIZES.end(); hordeSize++) {
+        std::list<rpcmsg::CastleCrasherData> castleCrashers = GameEngineBenchmark::spawnHorde(*hordeSize, randomGenerator);
+        gridTimings.push_back(GameEngineBenchmark::timeNeighborhoodGrid(castleCrashers));
+        crowdTimings.push_back(GameEngineBenchmark::timeCrowdSimulation(castleCrashers));
+        fullTickTimings.push_back(GameEngineBenchmark::timeFullTick(castleCrashers));
+    }
+
+    std::cout << std::endl << "Scaling (at most " << BENCHMARK_MAX_SCALING_RATIO << "x is linear):" << std::endl;
+    bool passed = GameEngineBenchmark::checkScaling("NeighborhoodGrid", gridTimings);
+    passed = GameEngineBenchmark::checkScaling("CrowdSimulation", crowdTimings) && passed;
+    passed = GameEngineBenchmark::checkScaling("updateProcedure", fullTickTimings) && passed;
+
+    // The horde cap is whatever a full tick can carry at p99
+    int largestFittingHorde = 0;
+    double largestFittingP99Milliseconds = tickBudgetMilliseconds;
+    bool hordeMaxFits = false;
+    for (size_t size = 0; size < HORDE_SIZES.size(); size++) {
+        bool fits = (fullTickTimings[size].p99Milliseconds <= tickBudgetMilliseconds);
+        if (fits && (HORDE_SIZES[size] > largestFittingHorde)) {
+            largestFittingHorde = HORDE_SIZES[size];
+            largestFittingP99Milliseconds = fullTickTimings[size].p99Milliseconds;
+        }
+        if (HORDE_SIZES[size] == HORDE_MAX_CASTLE_CRASHERS)
+            hordeMaxFits = fits;
+    }
+    // Linear headroom left over by the largest horde that fit
+    int projectedHorde = (int)(largestFittingHorde * tickBudgetMilliseconds / largestFittingP99Milliseconds);
+    std::cout << std::endl << "Largest horde measured within budget: " << largestFittingHorde << std::endl;
+    std::cout << "Projected horde for the budget: " << projectedHorde << std::endl;
+    std::cout << "HORDE_MAX_CASTLE_CRASHERS (" << HORDE_MAX_CASTLE_CRASHERS << ") "
+        << (hordeMaxFits ? "fits" : "does not fit") << " the budget" << std::endl;
+    passed = hordeMaxFits && passed;
+
+    std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+    return passed ? 0 : 1;
+}
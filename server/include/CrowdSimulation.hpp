@@ -0,0 +1,57 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/ext.hpp>
+
+#include "rpcMessages.hpp"
+#include "FlowField.hpp"
+#include "NeighborhoodGrid.hpp"
+
+/**
+ * Moves the castle crashers towards the treasure chest every tick. Each castle crasher
+ * follows the flow field, steers away from the castle crashers around it (found through
+ * the neighborhood grid) and climbs the terrain. Kept apart from the game engine so the
+ * movement stage can be run and timed on its own.
+ */
+class CrowdSimulation
+{
+private:
+
+    // How often a castle crasher is simulated. Server only, never sent to clients
+    struct CrasherLOD {
+        uint64_t lastSimulatedTick;
+        uint32_t simulationInterval;
+    };
+
+    std::unordered_map<uint32_t, CrasherLOD> castleCrasherLOD;    // By entity ID
+    std::unique_ptr<FlowField> flowField;
+    std::unique_ptr<NeighborhoodGrid> neighborhoodGrid;
+    std::function<float(const glm::vec2 &)> terrainHeight;
+
+    // Reused between ticks to avoid reallocating them
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> neighbors;
+
+    glm::vec3 getGoalDirection(const glm::vec3 & position, const glm::vec3 & endPosition) const;
+
+public:
+    CrowdSimulation(std::function<float(const glm::vec2 &)> terrainHeight);
+
+    // Advance the castle crashers to the given tick. Points of interest (chest, players) decide
+    // how often each castle crasher is simulated. The entity ID of every castle crasher that
+    // reached the chest this tick is added to arrivedEntityIDs
+    void update(std::list<rpcmsg::CastleCrasherData> & castleCrashers, uint64_t tick,
+        const std::vector<glm::vec2> & pointsOfInterest, std::vector<uint32_t> & arrivedEntityIDs);
+
+    // Forget the simulation rate of castle crashers that were removed from the game
+    void removeCastleCrasher(uint32_t entityID);
+    void clear();
+};
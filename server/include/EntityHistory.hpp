@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/ext.hpp>
+
+/**
+ * Bounded ring buffer of recent entity positions, one snapshot per engine tick. Used
+ * for lag compensation: hits are checked against the positions the shooter was
+ * looking at rather than the positions at the time the server processes the shot.
+ */
+class EntityHistory
+{
+public:
+
+    struct EntityState {
+        uint32_t  entityID;
+        glm::vec3 position;
+    };
+
+    struct Snapshot {
+        uint64_t                 tick;
+        uint64_t                 timeMilliseconds;
+        std::vector<EntityState> entities;
+    };
+
+private:
+
+    std::vector<Snapshot> snapshots;
+    uint64_t newestTick;
+    bool empty;
+
+public:
+    EntityHistory(size_t capacity);
+
+    // Start a new snapshot for the given tick, overwriting the oldest one.
+    // Returns the (cleared) list of entities for the caller to fill in
+    std::vector<EntityState> & record(uint64_t tick, uint64_t timeMilliseconds);
+
+    // Snapshot taken at the given tick, or nullptr if it is no longer kept
+    const Snapshot * findByTick(uint64_t tick) const;
+
+    // Latest snapshot taken at or before the given time. Falls back to the oldest
+    // snapshot kept if the time is older than the history. Returns nullptr if empty
+    const Snapshot * findByTime(uint64_t timeMilliseconds) const;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/ext.hpp>
+
+/**
+ * Precomputed vector field over the map grid (XZ plane) pointing every cell towards
+ * the closest goal cell. Castle crashers sample their walking direction from the field
+ * in O(1), so the cost of routing around obstacles and terrain is paid once per map
+ * change rather than once per castle crasher per tick.
+ */
+class FlowField
+{
+private:
+
+    struct Obstacle {
+        glm::vec2 center;
+        float     radius;
+    };
+
+    // Grid layout
+    glm::vec2 minCorner;
+    float cellSize;
+    int columns;
+    int rows;
+
+    // Map description the field was built from
+    glm::vec2 goalMinCorner;
+    glm::vec2 goalMaxCorner;
+    std::vector<Obstacle> obstacles;
+    std::function<float(const glm::vec2 &)> terrainHeight;
+    float slopeCost;
+    bool mapChanged;
+
+    // Computed field (one entry per cell)
+    std::vector<float> integrationCost;
+    std::vector<glm::vec2> directions;
+    std::vector<bool> blocked;
+
+    int getCellIndex(int column, int row) const;
+    glm::vec2 getCellCenter(int column, int row) const;
+    void build();
+
+public:
+    FlowField(const glm::vec2 & minCorner, const glm::vec2 & maxCorner, float cellSize);
+
+    // Describe the map. Any of these marks the field for recomputation
+    void setGoal(const glm::vec2 & goalMinCorner, const glm::vec2 & goalMaxCorner);
+    void setTerrain(std::function<float(const glm::vec2 &)> terrainHeight, float slopeCost);
+    void addObstacle(const glm::vec2 & center, float radius);
+    void clearObstacles();
+
+    // Recompute the field only if the map changed since the last build
+    void update();
+
+    // Walking direction (normalized, XZ plane) at the given world position.
+    // Returns a zero vector if there is no path from the position to the goal
+    glm::vec2 sampleDirection(const glm::vec3 & position) const;
+};
@@ -2,8 +2,13 @@
 #include <chrono>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <unordered_set>
 
 #include "rpcMessages.hpp"
+#include "CrowdSimulation.hpp"
+#include "EntityHistory.hpp"
+#include "TimingWheel.hpp"
 
 #define REFRESH_RATE           400
 #define MILLISECONDS_IN_SECOND 1000
@@ -21,10 +26,16 @@
 #define ARROW_DAMAGE                100.0f
 #define READY_UP_RADIUS             0.5f
 
+#define LAG_COMPENSATION_MAX_MILLISECONDS 250
+#define GAME_DATA_HISTORY_SIZE            128
+#define MICRO_TO_MILLISECONDS             1000
+#define MAX_PENDING_INPUT_SAMPLES         64
+#define CLOCK_OFFSET_RELAXATION_MICROSECONDS 1
+
 #define CASTLE_CRASHER_HIT_RADIUS   1.1f
 #define MAX_DIFFICULTY_SECONDS      180
 #define MAX_CASTLE_CRASHERS         75
-#define ANIMATION_TIME_SECONDS      1.0f
+#define HORDE_MAX_CASTLE_CRASHERS   2400     // Largest horde whose full tick fits the tick budget at p99 (server/benchmark)
 #define CASTLE_CRASHER_WALK_SPEED   2.0f
 #define CASTLE_CRASHER_ATTACK_SPEED 1.0f
 #define CASTLE_CRASHER_DAMAGE       1.0f
@@ -39,10 +50,30 @@
 #define CHEST_MAX_X                 9.0f
 #define CHEST_Z                     12
 
+#define GROUND_HEIGHT               0.5f
+#define FLOW_FIELD_CELL_SIZE        1.0f
+#define FLOW_FIELD_SLOPE_COST       2.0f
+#define DIRECT_APPROACH_DISTANCE    8.0f
+#define SEPARATION_RADIUS           1.5f
+#define SEPARATION_WEIGHT           1.5f
+#define MIN_STEERING_LENGTH         0.0001f
+
+#define LOD_NEAR_DISTANCE           25.0f
+#define LOD_MID_DISTANCE            50.0f
+#define LOD_MID_INTERVAL            4
+#define LOD_FAR_INTERVAL            16
+
 #define COMBO_TIME_SECONDS          3
+#define MULTIPLIER_DISPLAY_SECONDS  1
 #define MAX_MULTIPLIER              16
 #define BASE_POINTS_PER_HIT         200
 
+// Scheduled game events (TimingWheel event types)
+#define EVENT_SPAWN_READY           0
+#define EVENT_CASTLE_CRASHER_ATTACK 1
+#define EVENT_COMBO_EXPIRED         2
+#define EVENT_MULTIPLIER_EXPIRED    3
+
 static const glm::vec3 ARROW_POSITION_OFFSET = glm::vec3{ -0.0f, 0.0f, -0.4f };
 
 static const std::vector<glm::vec3> NOTIFICATION_SCREEN_LOCATION = {
@@ -50,21 +81,59 @@ static const std::vector<glm::vec3> NOTIFICATION_SCREEN_LOCATION = {
     glm::vec3(20.0f, 16.5f, -5.8),
 };
 
+// Hills on the map that castle crashers have to climb (center on XZ plane, radius, height)
+struct TerrainHill {
+    glm::vec2 center;
+    float     radius;
+    float     height;
+};
+
+static const std::vector<TerrainHill> TERRAIN_HILLS = {
+    { glm::vec2(-40.0f, -40.0f), 30.0f,  5.0f },
+    { glm::vec2( 26.0f, -80.0f), 20.0f,  7.0f },
+    { glm::vec2( 78.0f, -32.0f), 50.0f, 10.0f },
+};
+
 class GameEngine
 {
 private:
 
+    // Sets up game states and runs ticks by hand to time them (server/benchmark)
+    friend class GameEngineBenchmark;
+
     rpcmsg::GameData gameData;
+    uint64_t gameDataTick;
     std::mutex gameDataLock;
-    std::unordered_map<uint32_t, rpcmsg::PlayerData> newPlayerData;
+    std::condition_variable gameDataPublished;
+
+    // Recently published game data, kept around as baselines for delta snapshots
+    std::vector<std::shared_ptr<const rpcmsg::GameData>> gameDataHistory;
+    std::vector<uint64_t> gameDataHistoryTicks;
+
+    // Game data packed once per published tick and shared by every caller for that tick
+    std::shared_ptr<const std::vector<char>> serializedGameData;
+    uint64_t serializedGameDataTick;
+    std::shared_ptr<const std::vector<char>> serializedFullSnapshot;    // As a GameDataDelta without baseline
+    uint64_t serializedFullSnapshotTick;
+    std::mutex serializedGameDataLock;
+    std::unordered_set<uint32_t> registeredPlayers;    // Input from anyone else is dropped
+    std::unordered_map<uint32_t, rpcmsg::InputFrame> newPlayerInput;
+    std::unordered_map<uint32_t, std::vector<rpcmsg::InputFrame>> pendingPlayerInput;   // Samples not played back yet
+    std::unordered_map<uint32_t, int64_t> clientClockOffset;   // Server minus client clock (microseconds)
     std::mutex newPlayerDataLock;
 
     // Game meta data kept on server only
     std::chrono::nanoseconds gameStartTime;
-    std::chrono::nanoseconds lastSpawnTime;
-    std::chrono::nanoseconds spawnCooldownTimer;
     std::chrono::nanoseconds lastHitTime;
     float comboMultiplier;
+    uint32_t comboGeneration;
+    bool spawnReady;
+    bool hordeMode;
+    std::unique_ptr<TimingWheel> scheduledEvents;
+    std::unique_ptr<CrowdSimulation> crowdSimulation;
+    std::unique_ptr<EntityHistory> castleCrasherHistory;
+    uint64_t currentTick;
+    uint32_t nextEntityID;
 
     std::chrono::nanoseconds lastUpdateTime;
     std::chrono::time_point<std::chrono::system_clock> start;
@@ -80,22 +149,40 @@ private:
 
     glm::mat4 calculateFlyingArrowPose(const rpcmsg::ArrowData & arrowData);
 
+    glm::mat4 calculateNockedArrowPose(const glm::vec3 & dominantHandPosition,
+        const glm::vec3 & nonDominantHandPosition);
+
+    static float calculateTerrainHeight(const glm::vec2 & position);
+    uint64_t getCurrentTimeMilliseconds();
+
     void updateService();
     void updateProcedure();
     rpcmsg::GameData updatePlayerData(const rpcmsg::GameData & previousGameData);
+    rpcmsg::PlayerData createPlayerData(const rpcmsg::InputFrame & input);
+    void copyInputFrame(const rpcmsg::InputFrame & input, rpcmsg::PlayerData & playerData);
+    void applyPlayerInput(const rpcmsg::InputFrame & input, const int64_t * clientClockOffset,
+        rpcmsg::PlayerData & playerData, rpcmsg::GameData & updatedGameData);
     rpcmsg::GameData updateArrowData(const rpcmsg::GameData & previousGameData);
     rpcmsg::GameData updateMultiplierDisplay(const rpcmsg::GameData & previousGameData);
     rpcmsg::GameData updateCastleCrasher(const rpcmsg::GameData & previousGameData);
+    rpcmsg::GameData updateScheduledEvents(const rpcmsg::GameData & previousGameData);
     rpcmsg::GameData updateGameState(const rpcmsg::GameData & previousGameData);
     rpcmsg::GameData updateEasterEgg(const rpcmsg::GameData & previousGameData);
 
 
 public:
-    GameEngine();
+    GameEngine(bool hordeMode, bool runUpdateService = true);
     ~GameEngine();
 
     rpcmsg::GameData getCopyOfGameData();
-    void handleNewUserInput(uint32_t playerID, const rpcmsg::PlayerData & newInputs);
+    std::shared_ptr<const std::vector<char>> getSerializedGameData();
+    std::shared_ptr<const std::vector<char>> getSerializedFullSnapshot();
+    std::shared_ptr<const rpcmsg::GameData> getGameDataSnapshot(uint64_t & tick);
+    std::shared_ptr<const rpcmsg::GameData> findGameDataSnapshot(uint64_t tick);
+    bool waitForNewerGameData(uint64_t tick, std::chrono::nanoseconds timeout);
+    void handleNewUserInput(uint32_t playerID, const rpcmsg::InputFrame & newInputs);
+    void handleNewUserInput(uint32_t playerID, const std::vector<rpcmsg::InputFrame> & newInputSamples);
+    void addUser(uint32_t playerID);
     void removeUser(uint32_t playerID);
 };
 
@@ -1,4 +1,6 @@
 #include <unordered_map>
+#include <list>
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -9,7 +11,15 @@
 
 #include "rpc/server.h"
 #include "rpcMessages.hpp"
+#include "SnapshotDelta.hpp"
+#include "SocketStream.hpp"
+#include "DatagramSocket.hpp"
+#include "SharedMemoryRing.hpp"
 #include "GameEngine.hpp"
+#include "InterestManager.hpp"
+#include "SessionRegistry.hpp"
+#include "SnapshotOutbox.hpp"
+#include "TimingWheel.hpp"
 
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -22,41 +32,110 @@
 
 #define NUM_WORKER 10
 
-#define TIMEOUT_SECONDS           5
-#define MAINTENANCE_TIMER_SECONDS 1
+#define PER_CORE_RPC_LOOPS true    // Pin each session to one of a set of single threaded RPC servers
+
+#define TIMEOUT_SECONDS                5
+#define MAINTENANCE_TIMER_MILLISECONDS 100    // Also how finely session timeouts are tracked
+
+#define EVENT_SESSION_TIMEOUT 0    // Session timeout wheel event type
+
+#define LONG_POLL_MAX_MILLISECONDS 1000
+
+#define STREAM_MAX_CONTROL_MESSAGES 16             // Control messages queued per client before giving up on them
+#define STREAM_SEND_BUFFER_BYTES    (64 * 1024)    // Kernel send buffer for each snapshot stream
+
+#define STREAM_ACCEPT_RETRY_MIN_MILLISECONDS 10    // Wait after a failed accept, doubled while it keeps failing
+#define STREAM_ACCEPT_RETRY_MAX_MILLISECONDS 1000
+
+#define DATAGRAM_SIMULATED_LOSS 0.0f    // Fraction of outgoing snapshot datagrams to drop on purpose
 
 
 class GameServer
 {
 private:
 
-    struct CommunicationMetadata {
-        uint32_t playerID;
-        std::chrono::nanoseconds lastCommunicated;
+    struct SnapshotSubscriber {
+        std::unique_ptr<SocketStream> stream;
+        std::unique_ptr<SnapshotOutbox> outbox;
+        std::thread thread;
+        std::thread writerThread;
+        std::atomic<bool> finished;
+    };
+
+    struct DatagramPeer {
+        DatagramEndpoint endpoint;
+        uint64_t acknowledgedTick;
+        uint32_t tickInterval;
+        uint64_t nextSnapshotTick;
+        uint32_t snapshotByteBudget;
     };
 
     // Keeps track of server communication
-    std::unordered_map<uint32_t, CommunicationMetadata> communicationMetadata;
+    SessionRegistry sessions;
+    std::unique_ptr<TimingWheel> sessionTimeouts;    // Ticks of MAINTENANCE_TIMER_MILLISECONDS
+    std::mutex sessionTimeoutsLock;
     std::unique_ptr<rpc::server> server;
+    std::vector<std::unique_ptr<rpc::server>> loopServers;
     std::mutex requestSessionLock;
     bool serverActive;
 
     // Instance of the game engine
     std::unique_ptr<GameEngine> gameEngine;
 
+    // What each player gets to see of the game
+    std::unique_ptr<InterestManager> interestManager;
+
+    // Clients subscribed to have snapshots pushed to them
+    std::unique_ptr<SocketListener> snapshotListener;
+    std::thread snapshotAcceptThread;
+    std::list<std::unique_ptr<SnapshotSubscriber>> snapshotSubscribers;
+    std::mutex snapshotSubscribersLock;
+
+    // Clients using the UDP channel for input and snapshots
+    std::unique_ptr<DatagramSocket> datagramSocket;
+    std::unordered_map<uint32_t, DatagramPeer> datagramPeers;
+    std::mutex datagramPeersLock;
+    std::thread datagramReceiveThread;
+    std::thread datagramSendThread;
+
+    // Clients and tools on the same host read snapshots and write input through shared memory
+    int portNumber;
+    std::unique_ptr<SnapshotRing> sharedSnapshots;
+    std::unordered_map<uint32_t, std::unique_ptr<InputRing>> localInputRings;
+    std::mutex localInputRingsLock;
+    std::thread sharedMemoryThread;
+
     // Remote Procedure Calls
-    void updatePlayerData(uint32_t playerID, rpcmsg::PlayerData const & playerData);
-    std::vector<char> getEntireGameData();
-    uint32_t requestServerSession(const rpcmsg::PlayerData & playerData);
+    void updatePlayerData(uint32_t playerID, std::vector<rpcmsg::InputFrame> const & playerInputSamples);
+    rpcmsg::SerializedGameData getEntireGameData();
+    rpcmsg::SerializedGameData getGameDataDelta(uint32_t playerID, uint64_t baselineTick);
+    rpcmsg::SerializedGameData getGameDataIfNewer(uint64_t tick, uint32_t timeoutMilliseconds);
+    rpcmsg::SessionGrant requestServerSession(const rpcmsg::InputFrame & inputFrame);
+    std::string openLocalInput(uint32_t playerID, uint64_t sessionToken);
+    uint16_t getSessionLoopPort(uint32_t playerID);
+    rpcmsg::SnapshotSchedule negotiateSnapshotRate(uint32_t playerID, uint32_t snapshotRate);
     void closeServerSession(uint32_t playerID);
 
     // Helper function
+    bool applyPlayerInput(uint32_t playerID, std::vector<rpcmsg::InputFrame> const & playerInputSamples);
     std::chrono::nanoseconds getCurrentTime();
+    uint64_t getMaintenanceTick(std::chrono::nanoseconds time);
+    void scheduleSessionTimeout(uint32_t playerID, std::chrono::nanoseconds lastCommunicated);
+    uint32_t getSessionTickInterval(uint32_t playerID, uint32_t requestedSnapshotRate);
+    void bindSessionProcedures(rpc::server & rpcServer);
+    void bindRemoteProcedures(rpc::server & rpcServer);
+    void startRpcLoops();
     void serverPeriodicMaintenance();
+    void acceptSnapshotSubscribers();
+    void pushSnapshots(SnapshotSubscriber * subscriber);
+    void writeSnapshots(SnapshotSubscriber * subscriber, rpcmsg::SnapshotSubscription subscription);
+    void receiveDatagrams();
+    void sendSnapshotDatagrams();
+    void serveSharedMemory();
 
 public:
 
-    GameServer(int portNumber);
+    GameServer(int portNumber, bool hordeMode);
     ~GameServer();
     void stop();
     
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "rpcMessages.hpp"
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/ext.hpp>
+
+#define INTEREST_VIEW_HISTORY_SIZE     128
+#define INTEREST_NEAR_DISTANCE         15.0f
+#define INTEREST_FAR_DISTANCE          60.0f
+#define INTEREST_VIEW_HALF_ANGLE       1.3f     // Radians, wider than the headset's field of view
+#define INTEREST_REDUCED_INTERVAL      40       // Engine ticks between updates of out of view entities
+#define INTEREST_MAX_CASTLE_CRASHERS   250
+
+// With a byte budget, entities are refreshed highest priority first until it runs out.
+// Every tick an entity goes without a refresh adds to its priority
+#define PRIORITY_OTHER_PLAYER          400.0f
+#define PRIORITY_NEAR_CASTLE_CRASHER   300.0f
+#define PRIORITY_FLYING_ARROW          200.0f
+#define PRIORITY_FAR_CASTLE_CRASHER    100.0f
+#define PRIORITY_MULTIPLIER_DISPLAY    50.0f
+#define PRIORITY_PER_STALE_TICK        2.0f
+
+/**
+ * Builds the view of the game each player is sent. Castle crashers and combo text in
+ * front of the player or close to them are always up to date; ones off to the side or
+ * behind are refreshed every INTEREST_REDUCED_INTERVAL ticks, and ones that are also
+ * far away are left out. The views sent to each player are kept around since they,
+ * rather than the full game data, are what the player's deltas are made against.
+ *
+ * A player can also be given a byte budget per snapshot. The player's own data always
+ * goes out; other entities that changed are refreshed in priority order while they fit,
+ * and the rest keep the version the player already has until their turn comes up.
+ */
+class InterestManager
+{
+private:
+
+    struct PlayerViews {
+        std::vector<uint64_t> ticks;
+        std::vector<std::shared_ptr<const rpcmsg::GameData>> views;
+        std::unordered_map<uint64_t, uint64_t> refreshedTicks;    // Tick each entity was last refreshed
+    };
+
+    std::unordered_map<uint32_t, PlayerViews> playerViews;
+    std::mutex playerViewsLock;
+
+public:
+    InterestManager();
+
+    // View the player was sent at the given tick, or nullptr if it is no longer kept
+    std::shared_ptr<const rpcmsg::GameData> findView(uint32_t playerID, uint64_t tick);
+
+    // Build (and remember) the player's view of the game data at the given tick. Entities
+    // that are not due for a refresh, or don't fit in the byte budget (0 for no limit),
+    // are carried over from the baseline view
+    std::shared_ptr<const rpcmsg::GameData> buildView(uint32_t playerID, const rpcmsg::GameData & gameData,
+        uint64_t tick, const rpcmsg::GameData * baselineView, uint64_t baselineTick, size_t byteBudget);
+
+    void removePlayer(uint32_t playerID);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/ext.hpp>
+
+/**
+ * Uniform grid over the map (XZ plane) used to find nearby entities without comparing
+ * every pair. The grid is rebuilt from scratch every tick with a counting sort, so both
+ * building it and querying a fixed radius around each entity scale linearly with the
+ * number of entities.
+ */
+class NeighborhoodGrid
+{
+private:
+
+    glm::vec2 minCorner;
+    float cellSize;
+    int columns;
+    int rows;
+
+    // Entities sorted by cell. Entities of cell i are sortedEntities[cellStart[i]..cellStart[i + 1]).
+    // Their XZ positions are stored in the same order so a query reads memory front to back
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> sortedEntities;
+    std::vector<glm::vec2> sortedPositions;
+    std::vector<uint32_t> entityCell;
+
+    int getColumn(float x) const;
+    int getRow(float z) const;
+
+public:
+    NeighborhoodGrid(const glm::vec2 & minCorner, const glm::vec2 & maxCorner, float cellSize);
+
+    // Rebuild the grid. Entities are referred to by their index in the given list
+    void build(const std::vector<glm::vec3> & positions);
+
+    // Collect the index of every entity within radius of the given position.
+    // The radius should not be larger than the cell size
+    void findNeighbors(const glm::vec3 & position, float radius, std::vector<uint32_t> & neighbors) const;
+};
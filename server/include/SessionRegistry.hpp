@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#define SESSION_REGISTRY_SHARDS         16
+#define SESSION_REGISTRY_SHARD_CAPACITY 64    // Sessions each shard can hold at once
+
+/**
+ * Table of the sessions the server knows about, split into shards by player ID. Each shard
+ * is a fixed size open addressing table of atomic pointers to sessions, so looking up or
+ * stamping a session is a few atomic loads and never takes a lock. Adding and removing
+ * sessions takes the shard's lock, which is fine since that happens about once per session.
+ * A removed session can still be in the hands of a reader, so it is only retired, and freed
+ * by reclaimRetiredSessions once every reader that could have seen it is long done.
+ */
+class SessionRegistry
+{
+public:
+
+    struct Session {
+        uint32_t playerID;
+        uint64_t sessionToken;    // Secret handed to the client when the session was granted
+        std::atomic<int64_t> lastCommunicated;    // Nanoseconds, see GameServer::getCurrentTime
+        std::atomic<uint32_t> snapshotTickInterval;    // 0 until negotiated
+    };
+
+private:
+
+    struct Shard {
+        std::atomic<Session *> slots[SESSION_REGISTRY_SHARD_CAPACITY];    // nullptr if never used
+        std::mutex writeLock;
+    };
+
+    Shard shards[SESSION_REGISTRY_SHARDS];
+    std::atomic<size_t> sessionCount;
+
+    // Sessions removed since the last two reclaims. Only the older ones are freed each time
+    std::vector<Session *> retiredSessions;
+    std::vector<Session *> reclaimableSessions;
+    std::mutex retiredSessionsLock;
+
+    Shard & getShard(uint32_t playerID);
+    const Shard & getShard(uint32_t playerID) const;
+    Session * find(uint32_t playerID) const;
+
+public:
+    SessionRegistry();
+    ~SessionRegistry();
+
+    // Returns false if the player already has a session or their shard is full
+    bool add(uint32_t playerID, uint64_t sessionToken, std::chrono::nanoseconds currentTime);
+
+    // Returns false if the player had no session
+    bool remove(uint32_t playerID);
+
+    // Free the sessions removed before the previous call. Meant to be called periodically
+    // from a single thread, far enough apart that no lookup can span two calls
+    void reclaimRetiredSessions();
+
+    bool contains(uint32_t playerID) const;
+
+    // Returns false if the player has no session or the token is not the one they were granted
+    bool authenticate(uint32_t playerID, uint64_t sessionToken) const;
+
+    // Note that the player was just heard from. Returns false if they have no session
+    bool touch(uint32_t playerID, std::chrono::nanoseconds currentTime);
+
+    // When the player was last heard from. Returns false if they have no session
+    bool getLastCommunicated(uint32_t playerID, std::chrono::nanoseconds & lastCommunicated) const;
+
+    // Published ticks between the snapshots pushed to the player. Returns false (or 0) if
+    // they have no session
+    bool setSnapshotTickInterval(uint32_t playerID, uint32_t snapshotTickInterval);
+    uint32_t getSnapshotTickInterval(uint32_t playerID) const;
+
+    size_t size() const;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+#include "rpcMessages.hpp"
+
+/**
+ * What is waiting to be written to one client. Snapshots don't queue up: there is a
+ * single pending slot that every newer tick overwrites, so a slow client skips ahead to
+ * the latest state instead of working through stale ones in order. Control messages
+ * must all arrive and go first, in a queue with a fixed capacity. Either way the memory
+ * held for a client no matter how slow is bounded.
+ */
+class SnapshotOutbox
+{
+public:
+
+    struct Message {
+        bool isControl;
+        std::vector<char> control;                        // Packed control message
+        std::shared_ptr<const rpcmsg::GameData> gameData; // Published game data otherwise
+        uint64_t tick;
+    };
+
+private:
+
+    std::mutex lock;
+    std::condition_variable messageReady;
+    std::shared_ptr<const rpcmsg::GameData> pendingGameData;
+    uint64_t pendingTick;
+    std::deque<std::vector<char>> controlMessages;
+    size_t maxControlMessages;
+    uint64_t overwrittenSnapshots;
+    bool closed;
+
+public:
+    SnapshotOutbox(size_t maxControlMessages);
+
+    // Replace whatever snapshot hasn't been written yet
+    void offerSnapshot(std::shared_ptr<const rpcmsg::GameData> gameData, uint64_t tick);
+
+    // Returns false if the queue is full, in which case the client can't keep up
+    bool queueControlMessage(std::vector<char> message);
+
+    // Wait for the next message to write, control messages first. Returns false once the
+    // outbox is closed and every control message has been taken
+    bool waitForMessage(Message & message);
+
+    // Snapshots written over before they went out
+    uint64_t getOverwrittenSnapshots();
+
+    void close();
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Hierarchical timing wheel keyed by engine tick. Scheduling and expiring an event are
+ * O(1); each tick only touches the slot that is due, plus an occasional cascade of a
+ * coarser slot into the finer levels. Events are plain records, the owner decides what
+ * to do with them once they are due.
+ */
+class TimingWheel
+{
+public:
+
+    struct Event {
+        uint64_t dueTick;
+        uint32_t type;
+        uint32_t entityID;
+    };
+
+private:
+
+    static const int SLOT_BITS = 8;
+    static const int SLOTS_PER_LEVEL = 1 << SLOT_BITS;
+    static const int LEVELS = 3;
+
+    std::vector<std::vector<Event>> slots;   // LEVELS * SLOTS_PER_LEVEL buckets
+    uint64_t currentTick;
+    size_t pendingEvents;
+
+    void insert(const Event & event);
+    void cascade(int level);
+
+public:
+    TimingWheel(uint64_t startTick);
+
+    // Fire the event at the given tick. Ticks that already passed fire on the next advance
+    void schedule(uint64_t dueTick, uint32_t type, uint32_t entityID);
+
+    // Move the wheel forward to the given tick and append every event that became due
+    void advance(uint64_t tick, std::vector<Event> & dueEvents);
+
+    void clear();
+    size_t size() const;
+};
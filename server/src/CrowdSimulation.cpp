@@ -0,0 +1,143 @@
+#include "CrowdSimulation.hpp"
+#include "GameEngine.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+CrowdSimulation::CrowdSimulation(std::function<float(const glm::vec2 &)> terrainHeight)
+{
+    this->terrainHeight = terrainHeight;
+
+    // Build the flow field castle crashers follow towards the treasure chest
+    this->flowField = std::make_unique<FlowField>(
+        glm::vec2(CASTLE_CRASHER_MIN_X, CASTLE_CRASHER_MIN_Z),
+        glm::vec2(CASTLE_CRASHER_MAX_X, CASTLE_CRASHER_MAX_Z), FLOW_FIELD_CELL_SIZE);
+    this->flowField->setGoal(glm::vec2(CHEST_MIN_X, CHEST_Z), glm::vec2(CHEST_MAX_X, CASTLE_CRASHER_MAX_Z));
+    this->flowField->setTerrain(terrainHeight, FLOW_FIELD_SLOPE_COST);
+    this->flowField->update();
+
+    // Grid used to find the neighbors of each castle crasher
+    this->neighborhoodGrid = std::make_unique<NeighborhoodGrid>(
+        glm::vec2(CASTLE_CRASHER_MIN_X, CASTLE_CRASHER_MIN_Z),
+        glm::vec2(CASTLE_CRASHER_MAX_X, CASTLE_CRASHER_MAX_Z), SEPARATION_RADIUS);
+}
+
+// Walking direction (normalized) towards the chest. Follow the flow field until close enough
+// to the chest to head straight for the end position
+glm::vec3 CrowdSimulation::getGoalDirection(const glm::vec3 & position, const glm::vec3 & endPosition) const
+{
+    glm::vec3 direction = endPosition - position;
+    if (position.z < CHEST_Z - DIRECT_APPROACH_DISTANCE) {
+        glm::vec2 flowDirection = this->flowField->sampleDirection(position);
+        if (glm::length(flowDirection) > 0.0f)
+            direction = glm::vec3(flowDirection.x, 0.0f, flowDirection.y);
+    }
+    if (glm::length(direction) > MIN_STEERING_LENGTH)
+        direction = glm::normalize(direction);
+    return direction;
+}
+
+void CrowdSimulation::update(std::list<rpcmsg::CastleCrasherData> & castleCrashers, uint64_t tick,
+    const std::vector<glm::vec2> & pointsOfInterest, std::vector<uint32_t> & arrivedEntityIDs)
+{
+    // Only recomputes if the map changed since the last tick
+    this->flowField->update();
+
+    // Sort castle crashers into the neighborhood grid for the separation stage
+    this->positions.clear();
+    for (auto castleCrasher = castleCrashers.begin(); castleCrasher != castleCrashers.end(); castleCrasher++)
+        this->positions.push_back(rpcmsg::rpcToGLM(castleCrasher->position));
+    this->neighborhoodGrid->build(this->positions);
+    uint32_t castleCrasherIndex = 0;
+    float tickSeconds = 1.0f / (float)REFRESH_RATE;
+
+    // Castle crashers close to the chest or to a player are simulated every tick. The ones
+    // further out are simulated less often and catch up on the ticks they skipped in one go.
+    // Their turns are spread over the interval by entity ID so every tick does the same amount
+    // of work, rather than all of them lining up on the same tick
+    for (auto castleCrasher = castleCrashers.begin(); castleCrasher != castleCrashers.end(); castleCrasher++, castleCrasherIndex++) {
+        if (castleCrasher->alive) {
+
+            // New castle crashers start moving on their first tick
+            auto lod = this->castleCrasherLOD.find(castleCrasher->entityID);
+            if (lod == this->castleCrasherLOD.end())
+                lod = this->castleCrasherLOD.insert({ castleCrasher->entityID, { tick - 1, 1 } }).first;
+
+            // Not this castle crasher's turn yet
+            if ((tick + castleCrasher->entityID) % lod->second.simulationInterval != 0)
+                continue;
+            uint64_t elapsedTicks = tick - lod->second.lastSimulatedTick;
+            lod->second.lastSimulatedTick = tick;
+
+            // Castle crasher is walking to chest
+            if (castleCrasher->position.z < CHEST_Z) {
+
+                // Steer away from castle crashers that are too close so they don't stack up. The
+                // neighbors are only as fresh as their own last update, so this is looked up once
+                glm::vec3 position = this->positions[castleCrasherIndex];
+                glm::vec3 separation = glm::vec3(0.0f);
+                this->neighborhoodGrid->findNeighbors(position, SEPARATION_RADIUS, this->neighbors);
+                for (auto neighbor = this->neighbors.begin(); neighbor != this->neighbors.end(); neighbor++) {
+                    glm::vec3 offset = position - this->positions[*neighbor];
+                    offset.y = 0.0f;
+                    float distance = glm::length(offset);
+                    if ((*neighbor != castleCrasherIndex) && (distance > 0.0f))
+                        separation += (offset / distance) * (1.0f - distance / SEPARATION_RADIUS);
+                }
+
+                // Step through every skipped tick so the flow field, the direct approach and the
+                // terrain are followed the same way as at full rate
+                glm::vec3 endPosition = rpcmsg::rpcToGLM(castleCrasher->endPosition);
+                glm::vec3 facing = rpcmsg::rpcToGLM(castleCrasher->direction);
+                for (uint64_t step = 0; (step < elapsedTicks) && (position.z < CHEST_Z); step++) {
+                    glm::vec3 direction = this->getGoalDirection(position, endPosition) + separation * SEPARATION_WEIGHT;
+
+                    // Separation can cancel out the way to the chest. Stand still and keep facing
+                    // the same way rather than normalizing a zero vector
+                    if (glm::length(direction) > MIN_STEERING_LENGTH) {
+                        facing = direction;
+                        position += glm::normalize(direction) * CASTLE_CRASHER_WALK_SPEED * tickSeconds;
+                    }
+
+                    // Account for hills. If enemy recently spawn, gradually move enemy to surface
+                    float desiredY = this->terrainHeight(glm::vec2(position.x, position.z));
+                    if (std::abs(desiredY - position.y) > 0.1f) {
+                        float climb = std::min(3.0f * tickSeconds, std::abs(desiredY - position.y));
+                        position.y += ((desiredY - position.y) > 0) ? climb : -climb;
+                    }
+                }
+
+                castleCrasher->position = rpcmsg::glmToRPC(position);
+
+                // Headings go out in wire steps. Only turn once the heading crosses into another
+                // step, so a castle crasher walking straight doesn't resend it every tick
+                uint8_t heading = rpcmsg::quantizeHeading(rpcmsg::glmToRPC(facing));
+                if (heading != rpcmsg::quantizeHeading(castleCrasher->direction))
+                    castleCrasher->direction = rpcmsg::dequantizeHeading(heading);
+
+                // Reached the chest
+                if (castleCrasher->position.z >= CHEST_Z)
+                    arrivedEntityIDs.push_back(castleCrasher->entityID);
+            }
+
+            // Pick how often to simulate this castle crasher based on how close it is to anything relevant
+            glm::vec2 groundPosition = glm::vec2(castleCrasher->position.x, castleCrasher->position.z);
+            float closestDistance = std::numeric_limits<float>::max();
+            for (auto point = pointsOfInterest.begin(); point != pointsOfInterest.end(); point++)
+                closestDistance = std::min(closestDistance, glm::length(groundPosition - *point));
+            lod->second.simulationInterval = (closestDistance < LOD_NEAR_DISTANCE) ? 1 :
+                ((closestDistance < LOD_MID_DISTANCE) ? LOD_MID_INTERVAL : LOD_FAR_INTERVAL);
+        }
+    }
+}
+
+void CrowdSimulation::removeCastleCrasher(uint32_t entityID)
+{
+    this->castleCrasherLOD.erase(entityID);
+}
+
+void CrowdSimulation::clear()
+{
+    this->castleCrasherLOD.clear();
+}
@@ -0,0 +1,49 @@
+#include "EntityHistory.hpp"
+
+#include <algorithm>
+
+EntityHistory::EntityHistory(size_t capacity)
+{
+    this->snapshots.resize(std::max(capacity, (size_t)1));
+    this->newestTick = 0;
+    this->empty = true;
+}
+
+std::vector<EntityHistory::EntityState> & EntityHistory::record(uint64_t tick, uint64_t timeMilliseconds)
+{
+    Snapshot & snapshot = this->snapshots[tick % this->snapshots.size()];
+    snapshot.tick = tick;
+    snapshot.timeMilliseconds = timeMilliseconds;
+    snapshot.entities.clear();
+
+    this->newestTick = tick;
+    this->empty = false;
+    return snapshot.entities;
+}
+
+const EntityHistory::Snapshot * EntityHistory::findByTick(uint64_t tick) const
+{
+    if (this->empty || (tick > this->newestTick))
+        return nullptr;
+
+    const Snapshot & snapshot = this->snapshots[tick % this->snapshots.size()];
+    return (snapshot.tick == tick) ? &snapshot : nullptr;
+}
+
+const EntityHistory::Snapshot * EntityHistory::findByTime(uint64_t timeMilliseconds) const
+{
+    if (this->empty)
+        return nullptr;
+
+    // Walk back from the newest snapshot. Bounded by the capacity of the history
+    const Snapshot * oldestSnapshot = nullptr;
+    for (uint64_t age = 0; (age < this->snapshots.size()) && (age <= this->newestTick); age++) {
+        const Snapshot * snapshot = this->findByTick(this->newestTick - age);
+        if (snapshot == nullptr)
+            break;
+        if (snapshot->timeMilliseconds <= timeMilliseconds)
+            return snapshot;
+        oldestSnapshot = snapshot;
+    }
+    return oldestSnapshot;
+}
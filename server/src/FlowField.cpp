@@ -0,0 +1,200 @@
+#include "FlowField.hpp"
+
+#include <queue>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+static const float UNREACHABLE_COST = std::numeric_limits<float>::max();
+
+FlowField::FlowField(const glm::vec2 & minCorner, const glm::vec2 & maxCorner, float cellSize)
+{
+    this->minCorner = minCorner;
+    this->cellSize = cellSize;
+    this->columns = std::max(1, (int)std::ceil((maxCorner.x - minCorner.x) / cellSize));
+    this->rows = std::max(1, (int)std::ceil((maxCorner.y - minCorner.y) / cellSize));
+
+    // Default map: no goal, flat terrain and no obstacles
+    this->goalMinCorner = glm::vec2(0.0f);
+    this->goalMaxCorner = glm::vec2(0.0f);
+    this->terrainHeight = [](const glm::vec2 &) { return 0.0f; };
+    this->slopeCost = 0.0f;
+    this->mapChanged = true;
+}
+
+void FlowField::setGoal(const glm::vec2 & goalMinCorner, const glm::vec2 & goalMaxCorner)
+{
+    this->goalMinCorner = goalMinCorner;
+    this->goalMaxCorner = goalMaxCorner;
+    this->mapChanged = true;
+}
+
+void FlowField::setTerrain(std::function<float(const glm::vec2 &)> terrainHeight, float slopeCost)
+{
+    this->terrainHeight = terrainHeight;
+    this->slopeCost = slopeCost;
+    this->mapChanged = true;
+}
+
+void FlowField::addObstacle(const glm::vec2 & center, float radius)
+{
+    this->obstacles.push_back({ center, radius });
+    this->mapChanged = true;
+}
+
+void FlowField::clearObstacles()
+{
+    this->obstacles.clear();
+    this->mapChanged = true;
+}
+
+void FlowField::update()
+{
+    if (this->mapChanged) {
+        this->build();
+        this->mapChanged = false;
+    }
+}
+
+int FlowField::getCellIndex(int column, int row) const
+{
+    return row * this->columns + column;
+}
+
+glm::vec2 FlowField::getCellCenter(int column, int row) const
+{
+    return this->minCorner + glm::vec2((column + 0.5f) * this->cellSize, (row + 0.5f) * this->cellSize);
+}
+
+// Run Dijkstra from every goal cell outwards, then point each cell at its cheapest neighbor
+void FlowField::build()
+{
+    int totalCells = this->columns * this->rows;
+    this->integrationCost.assign(totalCells, UNREACHABLE_COST);
+    this->directions.assign(totalCells, glm::vec2(0.0f));
+    this->blocked.assign(totalCells, false);
+
+    // Sample the terrain and rasterize obstacles once per build
+    std::vector<float> cellHeight(totalCells);
+    for (int row = 0; row < this->rows; row++) {
+        for (int column = 0; column < this->columns; column++) {
+            glm::vec2 cellCenter = this->getCellCenter(column, row);
+            int cellIndex = this->getCellIndex(column, row);
+            cellHeight[cellIndex] = this->terrainHeight(cellCenter);
+            for (auto obstacle = this->obstacles.begin(); obstacle != this->obstacles.end(); obstacle++)
+                if (glm::length(cellCenter - obstacle->center) < obstacle->radius)
+                    this->blocked[cellIndex] = true;
+        }
+    }
+
+    // Seed the search with every cell inside the goal region
+    typedef std::pair<float, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> openCells;
+    for (int row = 0; row < this->rows; row++) {
+        for (int column = 0; column < this->columns; column++) {
+            glm::vec2 cellCenter = this->getCellCenter(column, row);
+            int cellIndex = this->getCellIndex(column, row);
+            if (this->blocked[cellIndex])
+                continue;
+            if ((cellCenter.x >= this->goalMinCorner.x) && (cellCenter.x <= this->goalMaxCorner.x) &&
+                (cellCenter.y >= this->goalMinCorner.y) && (cellCenter.y <= this->goalMaxCorner.y)) {
+                this->integrationCost[cellIndex] = 0.0f;
+                openCells.push({ 0.0f, cellIndex });
+            }
+        }
+    }
+
+    // Expand over the 8-connected grid. Walking uphill or downhill costs extra
+    static const int NEIGHBOR_OFFSET[8][2] = {
+        { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }, { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+    while (!openCells.empty()) {
+        QueueEntry current = openCells.top();
+        openCells.pop();
+        if (current.first > this->integrationCost[current.second])
+            continue;
+
+        int column = current.second % this->columns;
+        int row = current.second / this->columns;
+        for (int neighbor = 0; neighbor < 8; neighbor++) {
+            int neighborColumn = column + NEIGHBOR_OFFSET[neighbor][0];
+            int neighborRow = row + NEIGHBOR_OFFSET[neighbor][1];
+            if ((neighborColumn < 0) || (neighborColumn >= this->columns) || (neighborRow < 0) || (neighborRow >= this->rows))
+                continue;
+
+            // Don't let diagonal moves cut the corner of a blocked cell
+            int neighborIndex = this->getCellIndex(neighborColumn, neighborRow);
+            if (this->blocked[neighborIndex])
+                continue;
+            if (this->blocked[this->getCellIndex(neighborColumn, row)] || this->blocked[this->getCellIndex(column, neighborRow)])
+                continue;
+
+            float distance = this->cellSize * ((neighbor < 4) ? 1.0f : std::sqrt(2.0f));
+            float climb = std::abs(cellHeight[neighborIndex] - cellHeight[current.second]);
+            float neighborCost = current.first + distance + this->slopeCost * climb;
+            if (neighborCost < this->integrationCost[neighborIndex]) {
+                this->integrationCost[neighborIndex] = neighborCost;
+                openCells.push({ neighborCost, neighborIndex });
+            }
+        }
+    }
+
+    // Each reachable cell points towards its cheapest neighbor. Goal cells stay zero
+    for (int row = 0; row < this->rows; row++) {
+        for (int column = 0; column < this->columns; column++) {
+            int cellIndex = this->getCellIndex(column, row);
+            float bestCost = this->integrationCost[cellIndex];
+            if ((bestCost == UNREACHABLE_COST) || (bestCost == 0.0f))
+                continue;
+
+            glm::vec2 bestDirection = glm::vec2(0.0f);
+            for (int neighbor = 0; neighbor < 8; neighbor++) {
+                int neighborColumn = column + NEIGHBOR_OFFSET[neighbor][0];
+                int neighborRow = row + NEIGHBOR_OFFSET[neighbor][1];
+                if ((neighborColumn < 0) || (neighborColumn >= this->columns) || (neighborRow < 0) || (neighborRow >= this->rows))
+                    continue;
+                if (this->blocked[this->getCellIndex(neighborColumn, row)] || this->blocked[this->getCellIndex(column, neighborRow)])
+                    continue;
+
+                float neighborCost = this->integrationCost[this->getCellIndex(neighborColumn, neighborRow)];
+                if (neighborCost < bestCost) {
+                    bestCost = neighborCost;
+                    bestDirection = glm::normalize(glm::vec2((float)NEIGHBOR_OFFSET[neighbor][0], (float)NEIGHBOR_OFFSET[neighbor][1]));
+                }
+            }
+            this->directions[cellIndex] = bestDirection;
+        }
+    }
+}
+
+// Bilinearly blend the directions of the four closest cell centers
+glm::vec2 FlowField::sampleDirection(const glm::vec3 & position) const
+{
+    if (this->directions.empty())
+        return glm::vec2(0.0f);
+
+    float gridX = (position.x - this->minCorner.x) / this->cellSize - 0.5f;
+    float gridZ = (position.z - this->minCorner.y) / this->cellSize - 0.5f;
+    gridX = std::min(std::max(gridX, 0.0f), (float)(this->columns - 1));
+    gridZ = std::min(std::max(gridZ, 0.0f), (float)(this->rows - 1));
+
+    int column = std::min((int)gridX, this->columns - 1);
+    int row = std::min((int)gridZ, this->rows - 1);
+    int nextColumn = std::min(column + 1, this->columns - 1);
+    int nextRow = std::min(row + 1, this->rows - 1);
+    float weightX = gridX - (float)column;
+    float weightZ = gridZ - (float)row;
+
+    glm::vec2 direction =
+        this->directions[this->getCellIndex(column, row)] * ((1.0f - weightX) * (1.0f - weightZ)) +
+        this->directions[this->getCellIndex(nextColumn, row)] * (weightX * (1.0f - weightZ)) +
+        this->directions[this->getCellIndex(column, nextRow)] * ((1.0f - weightX) * weightZ) +
+        this->directions[this->getCellIndex(nextColumn, nextRow)] * (weightX * weightZ);
+
+    // Opposing directions can cancel out. Fall back to the closest cell in that case
+    if (glm::length(direction) < 0.001f) {
+        int closestColumn = (weightX < 0.5f) ? column : nextColumn;
+        int closestRow = (weightZ < 0.5f) ? row : nextRow;
+        return this->directions[this->getCellIndex(closestColumn, closestRow)];
+    }
+    return glm::normalize(direction);
+}
@@ -1,4 +1,6 @@
 #include "GameEngine.hpp"
+#include "SnapshotDelta.hpp"
+#include "rpc/config.h"
 #include <random>
 
 #include <LibOVR/OVR_CAPI.h>
@@ -9,11 +11,15 @@
 #include <glm/ext.hpp>
 
 #include <iostream>
+#include <algorithm>
 
 
 
-GameEngine::GameEngine()
+GameEngine::GameEngine(bool hordeMode, bool runUpdateService)
 {
+    // Spawn thousands of castle crashers instead of MAX_CASTLE_CRASHERS
+    this->hordeMode = hordeMode;
+
     // Determine how long program should sleep between update
     this->sleepDuration = std::chrono::nanoseconds(NANOSECONDS_IN_SECOND / REFRESH_RATE);
 
@@ -22,14 +28,37 @@ GameEngine::GameEngine()
     this->gameData.gameState.gameStarted = false;
     this->gameData.gameState.leftTowerReady = false;
     this->gameData.gameState.rightTowerReady = false;
-
-    // Launch new thread to update program with the given refresh rate
-    this->gameEngineServiceStatus = true;
+    this->gameData.gameState.serverTimeMilliseconds = 0;
+    this->gameDataTick = 0;
+    this->serializedGameDataTick = 0;
+    this->serializedFullSnapshotTick = 0;
+    this->gameDataHistory.resize(GAME_DATA_HISTORY_SIZE);
+    this->gameDataHistoryTicks.resize(GAME_DATA_HISTORY_SIZE, 0);
+    this->gameDataHistory[0] = std::make_shared<const rpcmsg::GameData>(this->gameData);
+
+    // Castle crashers walk along a flow field over the terrain towards the treasure chest
+    this->crowdSimulation = std::make_unique<CrowdSimulation>(GameEngine::calculateTerrainHeight);
+
+    // Keep enough castle crasher positions around to rewind to what the shooter saw
+    this->castleCrasherHistory = std::make_unique<EntityHistory>(
+        LAG_COMPENSATION_MAX_MILLISECONDS * REFRESH_RATE / MILLISECONDS_IN_SECOND + 1);
+    this->currentTick = 0;
+    this->nextEntityID = 1;
+
+    // Spawn cooldowns, attacks, combo and multiplier expiry only get looked at when due
+    this->scheduledEvents = std::make_unique<TimingWheel>(this->currentTick);
+    this->comboGeneration = 0;
+    this->spawnReady = true;
+
+    // Launch new thread to update program with the given refresh rate. Without it ticks
+    // only happen when updateProcedure is called by hand
+    this->gameEngineServiceStatus = runUpdateService;
     this->lastUpdateTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch());
-    std::thread gameEngineService(&GameEngine::updateService, this);
-    gameEngineService.detach();
-
-    std::cout << "\tSuccessfully started game engine service" << std::endl;
+    if (runUpdateService) {
+        std::thread gameEngineService(&GameEngine::updateService, this);
+        gameEngineService.detach();
+        std::cout << "\tSuccessfully started game engine service" << std::endl;
+    }
 }
 
 
@@ -72,17 +101,33 @@ void GameEngine::updateProcedure()
     this->gameDataLock.unlock();
 
     // Perform update procedure
+    this->currentTick++;
     updatedGameData = this->updatePlayerData(updatedGameData);
     updatedGameData = this->updateArrowData(updatedGameData);
     updatedGameData = this->updateMultiplierDisplay(updatedGameData);
     updatedGameData = this->updateCastleCrasher(updatedGameData);
+    updatedGameData = this->updateScheduledEvents(updatedGameData);
     updatedGameData = this->updateGameState(updatedGameData);
     updatedGameData = this->updateEasterEgg(updatedGameData);
-
-    // Assign the game state
+    updatedGameData.gameState.serverTimeMilliseconds = this->getCurrentTimeMilliseconds();
+    updatedGameData.tick = this->currentTick;
+
+    // Remember where each castle crasher was at this tick for lag compensation
+    std::vector<EntityHistory::EntityState> & castleCrasherStates = this->castleCrasherHistory->record(
+        this->currentTick, updatedGameData.gameState.serverTimeMilliseconds);
+    for (auto castleCrasher = updatedGameData.gameState.castleCrasherData.begin();
+        castleCrasher != updatedGameData.gameState.castleCrasherData.end(); castleCrasher++)
+        castleCrasherStates.push_back({ castleCrasher->entityID, rpcmsg::rpcToGLM(castleCrasher->position) });
+
+    // Assign the game state and keep it around as a delta baseline
+    std::shared_ptr<const rpcmsg::GameData> snapshot = std::make_shared<const rpcmsg::GameData>(std::move(updatedGameData));
     this->gameDataLock.lock();
-    this->gameData = updatedGameData;
+    this->gameData = *snapshot;
+    this->gameDataTick = this->currentTick;
+    this->gameDataHistory[this->currentTick % GAME_DATA_HISTORY_SIZE] = snapshot;
+    this->gameDataHistoryTicks[this->currentTick % GAME_DATA_HISTORY_SIZE] = this->currentTick;
     this->gameDataLock.unlock();
+    this->gameDataPublished.notify_all();
 }
 
 // Calculate the new velocity based on the current time
@@ -131,138 +176,242 @@ glm::mat4 GameEngine::calculateFlyingArrowPose(const rpcmsg::ArrowData & arrowDa
     return arrowPose;
 }
 
+// Calculate the pose of an arrow nocked on the bow, pointing from the drawing hand to the bow hand
+glm::mat4 GameEngine::calculateNockedArrowPose(const glm::vec3 & dominantHandPosition,
+    const glm::vec3 & nonDominantHandPosition)
+{
+    glm::vec3 arrowDirection = (nonDominantHandPosition - dominantHandPosition);
+    float arrowYZ_Angle = ((float)glm::asin(arrowDirection.y / glm::length(arrowDirection)) + (float)M_PI) * -1.0f;
+    float arrowXZ_Angle = ((float)glm::atan(arrowDirection.z / arrowDirection.x) + (float)(1.5 * M_PI)) * -1.0f;
+    if (arrowDirection.x < 0.0f)
+        arrowXZ_Angle += (float)M_PI;
+    glm::mat4 arrowPose = glm::translate(glm::mat4(1.0f), ARROW_POSITION_OFFSET);
+    arrowPose = glm::rotate(glm::mat4(1.0f), arrowYZ_Angle, glm::vec3(1.0f, 0.0f, 0.0f)) * arrowPose;
+    arrowPose = glm::rotate(glm::mat4(1.0f), arrowXZ_Angle, glm::vec3(0.0f, 1.0f, 0.0f)) * arrowPose;
+    arrowPose = glm::translate(glm::mat4(1.0f), dominantHandPosition) * arrowPose;
+
+    return arrowPose;
+}
+
+uint64_t GameEngine::getCurrentTimeMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+// Calculate the height of the ground (hills included) at the given XZ position
+float GameEngine::calculateTerrainHeight(const glm::vec2 & position)
+{
+    float height = GROUND_HEIGHT;
+    for (auto hill = TERRAIN_HILLS.begin(); hill != TERRAIN_HILLS.end(); hill++) {
+        float distance = glm::length(hill->center - position);
+        if (distance < hill->radius)
+            height += ((hill->radius - distance) / hill->radius) * hill->height;
+    }
+    return height;
+}
+
 rpcmsg::GameData GameEngine::updatePlayerData(const rpcmsg::GameData & previousGameData)
 {
-    // Get the new user input state
+    // Get the new user input state along with every sample that came in since the last tick
     this->newPlayerDataLock.lock();
-    std::unordered_map<uint32_t, rpcmsg::PlayerData> newPlayerDataInstance = this->newPlayerData;
+    std::unordered_map<uint32_t, rpcmsg::InputFrame> newPlayerInputInstance = this->newPlayerInput;
+    std::unordered_map<uint32_t, std::vector<rpcmsg::InputFrame>> pendingPlayerInputInstance;
+    pendingPlayerInputInstance.swap(this->pendingPlayerInput);
+    std::unordered_map<uint32_t, int64_t> clientClockOffsetInstance = this->clientClockOffset;
     this->newPlayerDataLock.unlock();
     std::unordered_map<uint32_t, rpcmsg::PlayerData> updatedPlayerData = previousGameData.playerData;
     rpcmsg::GameData updatedGameData = previousGameData;
 
     // SYNCING: If new player appear, add new player
-    for (auto player = newPlayerDataInstance.begin(); player != newPlayerDataInstance.end(); player++)
+    for (auto player = newPlayerInputInstance.begin(); player != newPlayerInputInstance.end(); player++)
         if (updatedPlayerData.find(player->first) == updatedPlayerData.end())
-            updatedPlayerData[player->first] = newPlayerDataInstance[player->first];
+            updatedPlayerData[player->first] = this->createPlayerData(newPlayerInputInstance[player->first]);
 
     // SYNCING: If a player disconnected, remove player
     for (auto player = updatedPlayerData.begin(); player != updatedPlayerData.end();) {
-        if (newPlayerDataInstance.find(player->first) == newPlayerDataInstance.end())
+        if (newPlayerInputInstance.find(player->first) == newPlayerInputInstance.end())
             player = updatedPlayerData.erase(player);
         else
             player++;
     }
 
-    // Note: Still old data. Not updated yet. Just has same keys as new player data
-    std::unordered_map<uint32_t, rpcmsg::PlayerData> previousPlayerData = updatedPlayerData;
-
-    // Update the state of the game based on the newly received user input
-    for (auto player = newPlayerDataInstance.begin(); player != newPlayerDataInstance.end(); player++) {
+    // Update the state of the game based on the newly received user input. Samples are played
+    // back in the order they were taken so no trigger press or release between ticks is missed.
+    // Without new samples the latest one is held
+    for (auto player = newPlayerInputInstance.begin(); player != newPlayerInputInstance.end(); player++) {
 
         uint32_t playerID = player->first;
+        auto clientClockOffset = clientClockOffsetInstance.find(playerID);
+        const int64_t * playerClockOffset =
+            (clientClockOffset != clientClockOffsetInstance.end()) ? &clientClockOffset->second : nullptr;
 
-        // Update the user's dominant hand
-        if (newPlayerDataInstance[playerID].handData[LEFT_HAND].buttonState & ovrButton::ovrButton_Y)
-            updatedPlayerData[playerID].dominantHand = LEFT_HAND;
-        if (newPlayerDataInstance[playerID].handData[RIGHT_HAND].buttonState & ovrButton::ovrButton_B)
-            updatedPlayerData[playerID].dominantHand = RIGHT_HAND;
-
-        uint32_t playerDominantHand = updatedPlayerData[playerID].dominantHand;
-        uint32_t playerNonDominantHand = (playerDominantHand == LEFT_HAND) ? RIGHT_HAND : LEFT_HAND;
-        glm::vec3 arrowReadyUpZone = glm::vec3((rpcmsg::rpcToGLM(newPlayerDataInstance[playerID].handData[playerNonDominantHand].handPose) * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, ARROW_READY_ZONE_Z_OFFSET)))[3]);
-        glm::vec3 arrowReloadZone = glm::vec3((rpcmsg::rpcToGLM(newPlayerDataInstance[playerID].headData.headPose) * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, ARROW_RELOAD_ZONE_Z_OFFSET)))[3]);
-        glm::vec3 dominantHandPosition = glm::vec3(rpcmsg::rpcToGLM(newPlayerDataInstance[playerID].handData[playerDominantHand].handPose)[3]);
-        glm::vec3 nonDominantHandPosition = glm::vec3(rpcmsg::rpcToGLM(newPlayerDataInstance[playerID].handData[playerNonDominantHand].handPose)[3]);
-        glm::mat4 dominantHandTransform = rpcmsg::rpcToGLM(newPlayerData[playerID].handData[playerDominantHand].handPose);
-
-        // Player released arrow (arrowReleased == true)
-        if (previousPlayerData[playerID].arrowReleased == true) {
-
-            // See if player's arrow landed and user can pick up another arrow
-            glm::vec3 arrowPosition = rpcmsg::rpcToGLM(previousPlayerData[playerID].arrowData.arrowPose)[3];
-            if (arrowPosition.y < 0.0f) {
-
-                // See if user is reaching for a new arrow
-                if (previousPlayerData[playerID].handData[playerDominantHand].handTriggerValue < 0.5f)
-                    if (newPlayerDataInstance[playerID].handData[playerDominantHand].handTriggerValue >= 0.5f)
-                        if (glm::length(arrowReloadZone - dominantHandPosition) < ARROW_RELOAD_ZONE_RADIUS)
-                            updatedPlayerData[playerID].arrowReleased = false;
-            }
+        auto samples = pendingPlayerInputInstance.find(playerID);
+        if ((samples == pendingPlayerInputInstance.end()) || samples->second.empty())
+            this->applyPlayerInput(player->second, playerClockOffset, updatedPlayerData[playerID], updatedGameData);
+        else
+            for (auto sample = samples->second.begin(); sample != samples->second.end(); sample++)
+                this->applyPlayerInput(*sample, playerClockOffset, updatedPlayerData[playerID], updatedGameData);
+    }
+
+    // Keep track of all the user's previous player data
+    updatedGameData.playerData = updatedPlayerData;
+    return updatedGameData;
+}
+
+// State of a player that just joined the game
+rpcmsg::PlayerData GameEngine::createPlayerData(const rpcmsg::InputFrame & input)
+{
+    rpcmsg::PlayerData playerData = rpcmsg::PlayerData();
+    playerData.arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f)));
+    playerData.dominantHand = RIGHT_HAND;
+    playerData.arrowReleased = true;
+    playerData.arrowReadying = false;
+    this->copyInputFrame(input, playerData);
+    return playerData;
+}
+
+// Take the head and hand state of the player from an input sample
+void GameEngine::copyInputFrame(const rpcmsg::InputFrame & input, rpcmsg::PlayerData & playerData)
+{
+    playerData.headData.headPose = input.headPose;
+    for (int handType = 0; handType < 2; handType++) {
+        playerData.handData[handType].handPose = input.handPose[handType];
+        playerData.handData[handType].thumbstickValue = input.thumbstickValue[handType];
+        playerData.handData[handType].buttonState = input.buttonState;
+        playerData.handData[handType].indexTriggerValue = input.indexTriggerValue[handType];
+        playerData.handData[handType].handTriggerValue = input.handTriggerValue[handType];
+    }
+    playerData.viewTimeMilliseconds = input.viewTimeMilliseconds;
+    playerData.sampleTimeMicroseconds = input.sampleTimeMicroseconds;
+    playerData.inputSequence = input.inputSequence;
+}
+
+// Advance a player's state by one input sample. New arrows in flight go into the game data
+void GameEngine::applyPlayerInput(const rpcmsg::InputFrame & input, const int64_t * clientClockOffset,
+    rpcmsg::PlayerData & playerData, rpcmsg::GameData & updatedGameData)
+{
+    // State before this sample
+    rpcmsg::PlayerData previousPlayerData = playerData;
+
+    // Update the user's dominant hand
+    if (input.buttonState & ovrButton::ovrButton_Y)
+        playerData.dominantHand = LEFT_HAND;
+    if (input.buttonState & ovrButton::ovrButton_B)
+        playerData.dominantHand = RIGHT_HAND;
+
+    uint32_t playerDominantHand = playerData.dominantHand;
+    uint32_t playerNonDominantHand = (playerDominantHand == LEFT_HAND) ? RIGHT_HAND : LEFT_HAND;
+    glm::vec3 arrowReadyUpZone = glm::vec3((rpcmsg::rpcToGLM(input.handPose[playerNonDominantHand]) * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, ARROW_READY_ZONE_Z_OFFSET)))[3]);
+    glm::vec3 arrowReloadZone = glm::vec3((rpcmsg::rpcToGLM(input.headPose) * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, ARROW_RELOAD_ZONE_Z_OFFSET)))[3]);
+    glm::vec3 dominantHandPosition = glm::vec3(rpcmsg::rpcToGLM(input.handPose[playerDominantHand])[3]);
+    glm::vec3 nonDominantHandPosition = glm::vec3(rpcmsg::rpcToGLM(input.handPose[playerNonDominantHand])[3]);
+    glm::mat4 dominantHandTransform = rpcmsg::rpcToGLM(input.handPose[playerDominantHand]);
+
+    // Player released arrow (arrowReleased == true)
+    if (previousPlayerData.arrowReleased == true) {
+
+        // See if player's arrow landed and user can pick up another arrow
+        glm::vec3 arrowPosition = rpcmsg::rpcToGLM(previousPlayerData.arrowData.arrowPose)[3];
+        if (arrowPosition.y < 0.0f) {
+
+            // See if user is reaching for a new arrow
+            if (previousPlayerData.handData[playerDominantHand].handTriggerValue < 0.5f)
+                if (input.handTriggerValue[playerDominantHand] >= 0.5f)
+                    if (glm::length(arrowReloadZone - dominantHandPosition) < ARROW_RELOAD_ZONE_RADIUS)
+                        playerData.arrowReleased = false;
         }
+    }
 
-        // Player is currently holding the arrow (arrowReleased == false && holding)
-        else if (newPlayerDataInstance[playerID].handData[playerDominantHand].handTriggerValue > 0.5f) {
-            glm::mat4 arrowPose = glm::translate(glm::mat4(1.0f), ARROW_POSITION_OFFSET);
-
-            // Player is ready to shoot
-            if (previousPlayerData[playerID].arrowReadying == true) {
-
-                // Update arrow pose
-                glm::vec3 arrowDirection = (nonDominantHandPosition - dominantHandPosition);
-                float arrowYZ_Angle = ((float)glm::asin(arrowDirection.y / glm::length(arrowDirection)) + (float)M_PI) * -1.0f;
-                float arrowXZ_Angle = ((float)glm::atan(arrowDirection.z / arrowDirection.x) + (float)(1.5 * M_PI)) * -1.0f;
-                if (arrowDirection.x < 0.0f)
-                    arrowXZ_Angle += (float)M_PI;
-                glm::mat4 arrowPose = glm::translate(glm::mat4(1.0f), ARROW_POSITION_OFFSET);
-                arrowPose = glm::rotate(glm::mat4(1.0f), arrowYZ_Angle, glm::vec3(1.0f, 0.0f, 0.0f)) * arrowPose;
-                arrowPose = glm::rotate(glm::mat4(1.0f), arrowXZ_Angle, glm::vec3(0.0f, 1.0f, 0.0f)) * arrowPose;
-                arrowPose = glm::translate(glm::mat4(1.0f), dominantHandPosition) * arrowPose;
-                updatedPlayerData[playerID].arrowData.arrowPose = rpcmsg::glmToRPC(arrowPose);
-
-                // Check if user is releasing arrow
-                if (newPlayerDataInstance[playerID].handData[playerDominantHand].indexTriggerValue < 0.5f) {
-
-                    // Store new variables for projectile calculation
-                    updatedPlayerData[playerID].arrowData.initPosition = rpcmsg::glmToRPC(glm::vec3(arrowPose[3]));
-                    updatedPlayerData[playerID].arrowData.initVelocity = rpcmsg::glmToRPC((nonDominantHandPosition - dominantHandPosition) * ARROW_VELOCITY_SCALE);
-                    updatedPlayerData[playerID].arrowData.launchTimeMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
-
-                    updatedPlayerData[playerID].arrowReleased = true;
-                    updatedPlayerData[playerID].arrowReadying = false;
-                    updatedPlayerData[playerID].arrowFiringAudioCue++;
-
-                    updatedGameData.gameState.flyingArrows.push_back(updatedPlayerData[playerID].arrowData);
-
-                    // Comment out this line to force user to wait for arrow to land before reloading
-                    updatedPlayerData[playerID].arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f)));
+    // Player is currently holding the arrow (arrowReleased == false && holding)
+    else if (input.handTriggerValue[playerDominantHand] > 0.5f) {
+        glm::mat4 arrowPose = glm::translate(glm::mat4(1.0f), ARROW_POSITION_OFFSET);
+
+        // Player is ready to shoot
+        if (previousPlayerData.arrowReadying == true) {
+
+            // Update arrow pose
+            glm::mat4 arrowPose = this->calculateNockedArrowPose(dominantHandPosition, nonDominantHandPosition);
+            playerData.arrowData.arrowPose = rpcmsg::glmToRPC(arrowPose);
+
+            // Check if user is releasing arrow
+            float previousIndexTrigger = previousPlayerData.handData[playerDominantHand].indexTriggerValue;
+            float newIndexTrigger = input.indexTriggerValue[playerDominantHand];
+            if (newIndexTrigger < 0.5f) {
+
+                // Find out when between the previous and the new input sample the trigger crossed
+                // the threshold, and where the hands were at that moment
+                float releaseFraction = (previousIndexTrigger > 0.5f) ?
+                    std::min((previousIndexTrigger - 0.5f) / (previousIndexTrigger - newIndexTrigger), 1.0f) : 0.0f;
+                glm::vec3 releaseDominantHandPosition = glm::mix(glm::vec3(rpcmsg::rpcToGLM(
+                    previousPlayerData.handData[playerDominantHand].handPose)[3]), dominantHandPosition, releaseFraction);
+                glm::vec3 releaseNonDominantHandPosition = glm::mix(glm::vec3(rpcmsg::rpcToGLM(
+                    previousPlayerData.handData[playerNonDominantHand].handPose)[3]), nonDominantHandPosition, releaseFraction);
+                arrowPose = this->calculateNockedArrowPose(releaseDominantHandPosition, releaseNonDominantHandPosition);
+
+                // Convert the release moment from the client's clock over to the server's clock
+                uint64_t previousSampleTime = previousPlayerData.sampleTimeMicroseconds;
+                uint64_t newSampleTime = input.sampleTimeMicroseconds;
+                uint64_t releaseTimeMilliseconds = this->getCurrentTimeMilliseconds();
+                if ((newSampleTime != 0) && (clientClockOffset != nullptr)) {
+                    uint64_t releaseSampleTime = (previousSampleTime < newSampleTime) ? previousSampleTime +
+                        (uint64_t)((newSampleTime - previousSampleTime) * releaseFraction) : newSampleTime;
+                    releaseTimeMilliseconds = std::min(releaseTimeMilliseconds,
+                        (uint64_t)((int64_t)releaseSampleTime + *clientClockOffset) / MICRO_TO_MILLISECONDS);
                 }
-            }
 
-            // Player is not readying to shoot
-            else {
+                // Store new variables for projectile calculation
+                playerData.arrowData.arrowPose = rpcmsg::glmToRPC(arrowPose);
+                playerData.arrowData.initPosition = rpcmsg::glmToRPC(glm::vec3(arrowPose[3]));
+                playerData.arrowData.initVelocity = rpcmsg::glmToRPC((releaseNonDominantHandPosition - releaseDominantHandPosition) * ARROW_VELOCITY_SCALE);
+                playerData.arrowData.launchTimeMilliseconds = releaseTimeMilliseconds;
 
-                // Update arrow pose
-                arrowPose = dominantHandTransform * arrowPose;
-                updatedPlayerData[playerID].arrowData.arrowPose = rpcmsg::glmToRPC(arrowPose);
+                // Remember how far behind the server the user was seeing the game
+                uint64_t viewTime = input.viewTimeMilliseconds;
+                uint64_t launchTime = playerData.arrowData.launchTimeMilliseconds;
+                playerData.arrowData.lagCompensationMilliseconds = ((viewTime == 0) || (viewTime > launchTime)) ? 0 :
+                    (uint32_t)std::min(launchTime - viewTime, (uint64_t)LAG_COMPENSATION_MAX_MILLISECONDS);
 
-                // Check if user is readying up to shoot
-                if (glm::length(arrowReadyUpZone - dominantHandPosition) < ARROW_READY_ZONE_RADIUS) {
-                    if (previousPlayerData[playerID].handData[playerDominantHand].indexTriggerValue < 0.5f) {
-                        if (newPlayerDataInstance[playerID].handData[playerDominantHand].indexTriggerValue >= 0.5f) {
-                            updatedPlayerData[playerID].arrowReadying = true;
-                            updatedPlayerData[playerID].arrowStretchingAudioCue++;
-                        }
-                    }
-                }
+                playerData.arrowReleased = true;
+                playerData.arrowReadying = false;
+                playerData.arrowFiringAudioCue++;
+
+                playerData.arrowData.entityID = this->nextEntityID++;
+                updatedGameData.gameState.flyingArrows.push_back(playerData.arrowData);
+
+                // Comment out this line to force user to wait for arrow to land before reloading
+                playerData.arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f)));
             }
         }
 
-        // Player dropped the arrow (arrowReleased == false && !holding)
+        // Player is not readying to shoot
         else {
-            updatedPlayerData[playerID].arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f)));
-            updatedPlayerData[playerID].arrowReleased = true;
-            updatedPlayerData[playerID].arrowReadying = false;
+
+            // Update arrow pose
+            arrowPose = dominantHandTransform * arrowPose;
+            playerData.arrowData.arrowPose = rpcmsg::glmToRPC(arrowPose);
+
+            // Check if user is readying up to shoot
+            if (glm::length(arrowReadyUpZone - dominantHandPosition) < ARROW_READY_ZONE_RADIUS) {
+                if (previousPlayerData.handData[playerDominantHand].indexTriggerValue < 0.5f) {
+                    if (input.indexTriggerValue[playerDominantHand] >= 0.5f) {
+                        playerData.arrowReadying = true;
+                        playerData.arrowStretchingAudioCue++;
+                    }
+                }
+            }
         }
+    }
 
-        // Update hand poses and button pressed
-        updatedPlayerData[playerID].headData = newPlayerDataInstance[playerID].headData;
-        updatedPlayerData[playerID].handData = newPlayerDataInstance[playerID].handData;
+    // Player dropped the arrow (arrowReleased == false && !holding)
+    else {
+        playerData.arrowData.arrowPose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f)));
+        playerData.arrowReleased = true;
+        playerData.arrowReadying = false;
     }
 
-    // Keep track of all the user's previous player data
-    updatedGameData.playerData = updatedPlayerData;
-    return updatedGameData;
+    // Update hand poses and button pressed
+    this->copyInputFrame(input, playerData);
 }
 
 rpcmsg::GameData GameEngine::updateArrowData(const rpcmsg::GameData & previousGameData) {
@@ -311,20 +460,37 @@ rpcmsg::GameData GameEngine::updateCastleCrasher(const rpcmsg::GameData & previo
     // Determine if arrows hit any of the castle crashers
     for (auto arrow = updatedGameData.gameState.flyingArrows.begin(); arrow != updatedGameData.gameState.flyingArrows.end();) {
         auto nextArrow = std::next(arrow);
+        glm::vec3 arrowPosition = rpcmsg::rpcToGLM(arrow->arrowPose)[3];
+
+        // Lag compensation: check the arrow against the castle crasher positions the shooter
+        // was seeing when they let go, rather than where the castle crashers are now
+        uint32_t hitEntityID = 0;
+        const EntityHistory::Snapshot * shooterView = this->castleCrasherHistory->findByTime(
+            (uint64_t)(currentTime.count() / MILLI_TO_NANOSECONDS) - arrow->lagCompensationMilliseconds);
+        if (shooterView != nullptr) {
+            for (auto entity = shooterView->entities.begin(); entity != shooterView->entities.end(); entity++) {
+                if (glm::length(arrowPosition - entity->position) < CASTLE_CRASHER_HIT_RADIUS) {
+                    hitEntityID = entity->entityID;
+                    break;
+                }
+            }
+        }
 
         // Check each castle crasher with this arrow
-        glm::vec3 arrowPosition = rpcmsg::rpcToGLM(arrow->arrowPose)[3];
         for (auto castleCrasher = updatedGameData.gameState.castleCrasherData.begin(); castleCrasher != updatedGameData.gameState.castleCrasherData.end(); castleCrasher++) {
             if (castleCrasher->alive) {
                 glm::vec3 castleCrasherPosition = rpcmsg::rpcToGLM(castleCrasher->position);
+                bool castleCrasherHit = (shooterView != nullptr) ? (castleCrasher->entityID == hitEntityID) :
+                    (glm::length(arrowPosition - castleCrasherPosition) < CASTLE_CRASHER_HIT_RADIUS);
 
                 // See if this arrow hit castle crasher
-                if (glm::length(arrowPosition - castleCrasherPosition) < CASTLE_CRASHER_HIT_RADIUS) {
+                if (castleCrasherHit) {
                     castleCrasher->health = std::max(castleCrasher->health - ARROW_DAMAGE, 0.0f);
                     castleCrasher->alive = (castleCrasher->health == 0.0f) ? false : true;
 
                     // If castle crasher died, update score
                     if (castleCrasher->alive == false) {
+                        this->crowdSimulation->removeCastleCrasher(castleCrasher->entityID);
                         updatedGameData.gameState.castleCrasherData.erase(castleCrasher);
                         if ((currentTime - this->lastHitTime).count() < (COMBO_TIME_SECONDS * NANOSECONDS_IN_SECOND))
                             this->comboMultiplier = std::min(this->comboMultiplier * 2.0f, (float)MAX_MULTIPLIER);
@@ -340,9 +506,17 @@ rpcmsg::GameData GameEngine::updateCastleCrasher(const rpcmsg::GameData & previo
                         newMultiplierDisplayData.pose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), multiplierLocation));
                         newMultiplierDisplayData.opacity = 1.0f;
                         newMultiplierDisplayData.multiplier = (uint32_t) this->comboMultiplier;
+                        newMultiplierDisplayData.entityID = this->nextEntityID++;
                         updatedGameData.gameState.multiplierDisplayData.push_back(newMultiplierDisplayData);
+                        this->scheduledEvents->schedule(this->currentTick + MULTIPLIER_DISPLAY_SECONDS * REFRESH_RATE,
+                            EVENT_MULTIPLIER_EXPIRED, newMultiplierDisplayData.entityID);
                     }
                     this->lastHitTime = currentTime;
+
+                    // Any earlier combo expiry is now stale
+                    this->comboGeneration++;
+                    this->scheduledEvents->schedule(this->currentTick + COMBO_TIME_SECONDS * REFRESH_RATE,
+                        EVENT_COMBO_EXPIRED, this->comboGeneration);
                     updatedGameData.gameState.flyingArrows.erase(arrow);
                     break;
                 }
@@ -362,14 +536,16 @@ rpcmsg::GameData GameEngine::updateCastleCrasher(const rpcmsg::GameData & previo
         // Figure out the ideal number of castle crashers to show at this time
         double idealCastleCrasherPercentAlive = ((currentTime - startTime).count()) / (double)(NANOSECONDS_IN_SECOND * MAX_DIFFICULTY_SECONDS);
         idealCastleCrasherPercentAlive = std::min(idealCastleCrasherPercentAlive, 1.0);
-        int idealCastleCrasherAlive = (int)(MAX_CASTLE_CRASHERS * idealCastleCrasherPercentAlive);
+        int maxCastleCrashers = this->hordeMode ? HORDE_MAX_CASTLE_CRASHERS : MAX_CASTLE_CRASHERS;
+        int idealCastleCrasherAlive = (int)(maxCastleCrashers * idealCastleCrasherPercentAlive);
 
         // If ideal is higher than actual, see if we should spawn a new castle crasher
         if (idealCastleCrasherAlive > updatedGameData.gameState.castleCrasherData.size()) {
-            if (currentTime > (lastSpawnTime + spawnCooldownTimer)) {
+            if (this->hordeMode || this->spawnReady) {
 
                 // Initialize new castle crasher and add them
                 rpcmsg::CastleCrasherData newCastleCrasher;
+                newCastleCrasher.entityID = this->nextEntityID++;
                 newCastleCrasher.id = (uint8_t)distribution(randomGenerator);
                 newCastleCrasher.alive = true;
                 newCastleCrasher.health = 100.0f;
@@ -388,61 +564,74 @@ rpcmsg::GameData GameEngine::updateCastleCrasher(const rpcmsg::GameData & previo
                 // Update spawn cooldown timer
                 float spawnTimeRandom = (float)(distribution(randomGenerator) % 1000) / 1000.0f;
                 float spawnCooldownSeconds = 2.5f * spawnTimeRandom;
-                this->spawnCooldownTimer = std::chrono::nanoseconds((long long)(spawnCooldownSeconds * NANOSECONDS_IN_SECOND));
-                this->lastSpawnTime = currentTime;
+                if (!this->hordeMode) {
+                    this->spawnReady = false;
+                    this->scheduledEvents->schedule(this->currentTick + (uint64_t)(spawnCooldownSeconds * REFRESH_RATE),
+                        EVENT_SPAWN_READY, 0);
+                }
             }
         }
     }
 
-    // Update the position of each of the castle crasher and attack damge to chest
-    for (auto castleCrasher = updatedGameData.gameState.castleCrasherData.begin(); castleCrasher != updatedGameData.gameState.castleCrasherData.end(); castleCrasher++) {
-        if (castleCrasher->alive) {
-            castleCrasher->animationCycle += ((1.0f / ANIMATION_TIME_SECONDS) * (1.0f / REFRESH_RATE)) * 360.0f;
-            if (castleCrasher->animationCycle >= 360.0f)
-                castleCrasher->animationCycle = 0.0f;
-
-            // Castle crasher is walking to chest
-            if (castleCrasher->position.z < CHEST_Z) {
-
-                // Update castle crasher direction
-                glm::vec3 direction = rpcmsg::rpcToGLM(castleCrasher->endPosition) - rpcmsg::rpcToGLM(castleCrasher->position);
-                castleCrasher->direction = rpcmsg::glmToRPC(direction);
-
-                // Calculate the castle crasher delta position in one second
-                glm::vec3 deltaPosition = glm::normalize(direction) * CASTLE_CRASHER_WALK_SPEED;
-
-                // Calculate the castle crasher updated position
-                glm::vec3 newPosition = rpcmsg::rpcToGLM(castleCrasher->position);
-                newPosition += deltaPosition / (float)REFRESH_RATE;
-
-                // Account for hills
-                float desiredY = 0.5f;
-                if (glm::length(glm::vec2(-40.0f, -40.0f) - glm::vec2(newPosition.x, newPosition.z)) < 30.0f)
-                    desiredY += ((30.0f - glm::length(glm::vec2(-40.0f, -40.0f) - glm::vec2(newPosition.x, newPosition.z))) / 30.0f) * 5.0f;
-                if (glm::length(glm::vec2(26.0f, -80.0f) - glm::vec2(newPosition.x, newPosition.z)) < 20.0f)
-                    desiredY += ((20.0f - glm::length(glm::vec2(26.0f, -80.0f) - glm::vec2(newPosition.x, newPosition.z))) / 20.0f) * 7.0f;
-                if (glm::length(glm::vec2(78.0f, -32.0f) - glm::vec2(newPosition.x, newPosition.z)) < 50.0f)
-                    desiredY += ((50.0f - glm::length(glm::vec2(78.0f, -32.0f) - glm::vec2(newPosition.x, newPosition.z))) / 50.0f) * 10.0f;
+    // Castle crashers close to the chest or to a player are simulated every tick
+    std::vector<glm::vec2> pointsOfInterest;
+    pointsOfInterest.push_back(glm::vec2((CHEST_MIN_X + CHEST_MAX_X) / 2.0f, (float)CHEST_Z));
+    for (auto player = updatedGameData.playerData.begin(); player != updatedGameData.playerData.end(); player++) {
+        glm::vec3 headPosition = rpcmsg::rpcToGLM(player->second.headData.headPose)[3];
+        pointsOfInterest.push_back(glm::vec2(headPosition.x, headPosition.z));
+    }
 
-                // If enemy recently spawn, gradually move enemy to surface
-                if (std::abs(desiredY - newPosition.y) > 0.1f)
-                    newPosition.y += (((desiredY - newPosition.y) > 0) ? 3.0f : -3.0f) / REFRESH_RATE;
+    // Move the castle crashers. The ones that reached the chest start attacking on the next tick
+    std::vector<uint32_t> arrivedEntityIDs;
+    this->crowdSimulation->update(updatedGameData.gameState.castleCrasherData, this->currentTick,
+        pointsOfInterest, arrivedEntityIDs);
+    for (auto entityID = arrivedEntityIDs.begin(); entityID != arrivedEntityIDs.end(); entityID++)
+        this->scheduledEvents->schedule(this->currentTick + 1, EVENT_CASTLE_CRASHER_ATTACK, *entityID);
 
-                castleCrasher->position = rpcmsg::glmToRPC(newPosition);
+    return updatedGameData;
+}
 
+// Handle the game events that are due this tick
+rpcmsg::GameData GameEngine::updateScheduledEvents(const rpcmsg::GameData & previousGameData)
+{
+    rpcmsg::GameData updatedGameData = previousGameData;
+    std::vector<TimingWheel::Event> dueEvents;
+    this->scheduledEvents->advance(this->currentTick, dueEvents);
+
+    for (auto event = dueEvents.begin(); event != dueEvents.end(); event++) {
+        switch (event->type) {
+
+        // Spawn cooldown is over
+        case EVENT_SPAWN_READY:
+            this->spawnReady = true;
+            break;
+
+        // Castle crasher attacks the chest, unless it died or the game ended in the meantime
+        case EVENT_CASTLE_CRASHER_ATTACK: {
+            auto castleCrasher = std::find_if(updatedGameData.gameState.castleCrasherData.begin(),
+                updatedGameData.gameState.castleCrasherData.end(),
+                [event](const rpcmsg::CastleCrasherData & data) { return data.entityID == event->entityID; });
+            if ((castleCrasher != updatedGameData.gameState.castleCrasherData.end()) && castleCrasher->alive) {
+                updatedGameData.gameState.castleHealth = std::max(0.0f,
+                    updatedGameData.gameState.castleHealth - CASTLE_CRASHER_DAMAGE);
+                castleCrasher->lastAttackTimeMilliseconds = (uint32_t)this->getCurrentTimeMilliseconds();
+                this->scheduledEvents->schedule(this->currentTick + (uint64_t)(CASTLE_CRASHER_ATTACK_SPEED * REFRESH_RATE),
+                    EVENT_CASTLE_CRASHER_ATTACK, castleCrasher->entityID);
             }
+            break;
+        }
 
-            // Castle crasher is attacking chest
-            else {
-                long long nextAttackReadyAt = (castleCrasher->lastAttackTimeMilliseconds * MILLI_TO_NANOSECONDS) +
-                    (long long)((double)CASTLE_CRASHER_ATTACK_SPEED * NANOSECONDS_IN_SECOND);
-                if (nextAttackReadyAt < currentTime.count()) {
-                    updatedGameData.gameState.castleHealth = std::max(0.0f,
-                        updatedGameData.gameState.castleHealth - CASTLE_CRASHER_DAMAGE);
-                    castleCrasher->lastAttackTimeMilliseconds = (uint32_t)(currentTime.count() / MILLI_TO_NANOSECONDS);
-                }
-
-            }
+        // No hit within the combo time. Only the latest scheduled expiry counts
+        case EVENT_COMBO_EXPIRED:
+            if (event->entityID == this->comboGeneration)
+                this->comboMultiplier = 1.0f;
+            break;
+
+        // Multiplier text has faded out
+        case EVENT_MULTIPLIER_EXPIRED:
+            updatedGameData.gameState.multiplierDisplayData.remove_if(
+                [event](const rpcmsg::MultiplierDisplayData & data) { return data.entityID == event->entityID; });
+            break;
         }
     }
 
@@ -452,21 +641,14 @@ rpcmsg::GameData GameEngine::updateCastleCrasher(const rpcmsg::GameData & previo
 rpcmsg::GameData GameEngine::updateMultiplierDisplay(const rpcmsg::GameData & previousGameData)
 {
     rpcmsg::GameData updatedGameData = previousGameData;
-    for (auto multiplierData = updatedGameData.gameState.multiplierDisplayData.begin();
-        multiplierData != updatedGameData.gameState.multiplierDisplayData.end();) {
-
-        // No more opacity, don't have to render anymore
-        if (multiplierData->opacity <= 0.0f)
-            multiplierData = updatedGameData.gameState.multiplierDisplayData.erase(multiplierData);
 
-        // Else, update how to draw
-        else {
-            glm::vec3 multiplierLocation = rpcmsg::rpcToGLM(multiplierData->pose)[3];
-            multiplierLocation.y += 1.0f / REFRESH_RATE;
-            multiplierData->pose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), multiplierLocation));
-            multiplierData->opacity -= 1.0f / REFRESH_RATE;
-            multiplierData++;
-        }
+    // Float the text upwards while fading it out. Removal is scheduled when the text is created
+    for (auto multiplierData = updatedGameData.gameState.multiplierDisplayData.begin();
+        multiplierData != updatedGameData.gameState.multiplierDisplayData.end(); multiplierData++) {
+        glm::vec3 multiplierLocation = rpcmsg::rpcToGLM(multiplierData->pose)[3];
+        multiplierLocation.y += 1.0f / REFRESH_RATE;
+        multiplierData->pose = rpcmsg::glmToRPC(glm::translate(glm::mat4(1.0f), multiplierLocation));
+        multiplierData->opacity = std::max(multiplierData->opacity - 1.0f / (MULTIPLIER_DISPLAY_SECONDS * REFRESH_RATE), 0.0f);
     }
 
     return updatedGameData;
@@ -476,11 +658,7 @@ rpcmsg::GameData GameEngine::updateGameState(const rpcmsg::GameData & previousGa
 {
     rpcmsg::GameData updatedGameData = previousGameData;
 
-    // Update multiplier
-    std::chrono::nanoseconds currentTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
-        std::chrono::high_resolution_clock::now().time_since_epoch());
-    if ((currentTime - this->lastHitTime).count() > (COMBO_TIME_SECONDS * NANOSECONDS_IN_SECOND))
-        this->comboMultiplier = 1.0f;
+    // Update multiplier (combo expiry is handled by the scheduled events)
     updatedGameData.gameState.scoreMultiplier = (uint32_t) this->comboMultiplier;
 
     // If game state haven't started, check to see if both users are ready
@@ -510,6 +688,7 @@ rpcmsg::GameData GameEngine::updateGameState(const rpcmsg::GameData & previousGa
             updatedGameData.gameState.leftTowerReady = false;
             updatedGameData.gameState.rightTowerReady = false;
             std::list<rpcmsg::CastleCrasherData>().swap(updatedGameData.gameState.castleCrasherData);
+            this->crowdSimulation->clear();
         }
     }
 
@@ -546,14 +725,124 @@ rpcmsg::GameData GameEngine::getCopyOfGameData() {
     return gameDataInstance;
 }
 
-void GameEngine::handleNewUserInput(uint32_t playerID, const rpcmsg::PlayerData & newInputs) {
+// Latest published game state along with the tick it was published at
+std::shared_ptr<const rpcmsg::GameData> GameEngine::getGameDataSnapshot(uint64_t & tick) {
+    std::lock_guard<std::mutex> gameDataGuard(this->gameDataLock);
+    tick = this->gameDataTick;
+    return this->gameDataHistory[tick % GAME_DATA_HISTORY_SIZE];
+}
+
+// Game state published at the given tick, or nullptr if it is too old to still be kept
+std::shared_ptr<const rpcmsg::GameData> GameEngine::findGameDataSnapshot(uint64_t tick) {
+    std::lock_guard<std::mutex> gameDataGuard(this->gameDataLock);
+    if ((tick == 0) || (tick > this->gameDataTick) || (this->gameDataHistoryTicks[tick % GAME_DATA_HISTORY_SIZE] != tick))
+        return nullptr;
+    return this->gameDataHistory[tick % GAME_DATA_HISTORY_SIZE];
+}
+
+// Wait until a tick newer than the given one is published. Returns false if that didn't
+// happen within the timeout
+bool GameEngine::waitForNewerGameData(uint64_t tick, std::chrono::nanoseconds timeout) {
+    std::unique_lock<std::mutex> gameDataGuard(this->gameDataLock);
+    return this->gameDataPublished.wait_for(gameDataGuard, timeout, [this, tick]() {
+        return this->gameDataTick > tick; });
+}
+
+// Packed copy of the latest game state. Only the first caller after a new tick is
+// published pays for packing, everyone else shares the same buffer
+std::shared_ptr<const std::vector<char>> GameEngine::getSerializedGameData() {
+    std::lock_guard<std::mutex> serializedGameDataGuard(this->serializedGameDataLock);
+
+    this->gameDataLock.lock();
+    if (this->serializedGameData && (this->serializedGameDataTick == this->gameDataTick)) {
+        this->gameDataLock.unlock();
+        return this->serializedGameData;
+    }
+    rpcmsg::GameData gameDataInstance = this->gameData;
+    uint64_t gameDataTickInstance = this->gameDataTick;
+    this->gameDataLock.unlock();
+
+    RPCLIB_MSGPACK::sbuffer buffer;
+    RPCLIB_MSGPACK::pack(buffer, gameDataInstance);
+    this->serializedGameData = std::make_shared<const std::vector<char>>(buffer.data(), buffer.data() + buffer.size());
+    this->serializedGameDataTick = gameDataTickInstance;
+    return this->serializedGameData;
+}
+
+// Latest game state packed as a delta without a baseline, which is what anyone asking for a
+// delta without having a baseline gets. Packed once per published tick just like above
+std::shared_ptr<const std::vector<char>> GameEngine::getSerializedFullSnapshot() {
+    std::lock_guard<std::mutex> serializedGameDataGuard(this->serializedGameDataLock);
+
+    uint64_t tick;
+    std::shared_ptr<const rpcmsg::GameData> snapshot = this->getGameDataSnapshot(tick);
+    if (this->serializedFullSnapshot && (this->serializedFullSnapshotTick == tick))
+        return this->serializedFullSnapshot;
+
+    RPCLIB_MSGPACK::sbuffer buffer;
+    RPCLIB_MSGPACK::pack(buffer, rpcmsg::makeGameDataDelta(nullptr, 0, *snapshot, tick));
+    this->serializedFullSnapshot = std::make_shared<const std::vector<char>>(buffer.data(), buffer.data() + buffer.size());
+    this->serializedFullSnapshotTick = tick;
+    return this->serializedFullSnapshot;
+}
+
+void GameEngine::handleNewUserInput(uint32_t playerID, const rpcmsg::InputFrame & newInputs) {
+    this->handleNewUserInput(playerID, std::vector<rpcmsg::InputFrame>(1, newInputs));
+}
+
+// Queue a batch of input samples, oldest first, to be played back on the next tick
+void GameEngine::handleNewUserInput(uint32_t playerID, const std::vector<rpcmsg::InputFrame> & newInputSamples) {
+    int64_t receiveTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+
+    this->newPlayerDataLock.lock();
+
+    // Input can still be on its way in when the player is removed. It must not bring them back
+    if (this->registeredPlayers.find(playerID) == this->registeredPlayers.end()) {
+        this->newPlayerDataLock.unlock();
+        return;
+    }
+    std::vector<rpcmsg::InputFrame> & pendingSamples = this->pendingPlayerInput[playerID];
+    for (auto newInputs = newInputSamples.begin(); newInputs != newInputSamples.end(); newInputs++) {
+
+        // Input can be handled out of order by the RPC workers. Anything older than what we
+        // already have is of no use anymore
+        auto previousInputs = this->newPlayerInput.find(playerID);
+        if ((previousInputs != this->newPlayerInput.end()) && (newInputs->inputSequence <= previousInputs->second.inputSequence))
+            continue;
+        this->newPlayerInput[playerID] = *newInputs;
+        pendingSamples.push_back(*newInputs);
+
+        // Track the offset between the client's clock and ours. The smallest offset seen belongs to the
+        // fastest delivery; let it relax slowly so the estimate can follow clock drift
+        if (newInputs->sampleTimeMicroseconds != 0) {
+            int64_t measuredOffset = receiveTime - (int64_t)newInputs->sampleTimeMicroseconds;
+            auto offset = this->clientClockOffset.find(playerID);
+            if (offset == this->clientClockOffset.end())
+                this->clientClockOffset[playerID] = measuredOffset;
+            else
+                offset->second = std::min(measuredOffset, offset->second + CLOCK_OFFSET_RELAXATION_MICROSECONDS);
+        }
+    }
+
+    // Don't let a player that floods us with samples hold up the tick
+    if (pendingSamples.size() > MAX_PENDING_INPUT_SAMPLES)
+        pendingSamples.erase(pendingSamples.begin(), pendingSamples.end() - MAX_PENDING_INPUT_SAMPLES);
+    this->newPlayerDataLock.unlock();
+}
+
+// Players only take part between addUser and removeUser
+void GameEngine::addUser(uint32_t playerID) {
     this->newPlayerDataLock.lock();
-    this->newPlayerData[playerID] = newInputs;
+    this->registeredPlayers.insert(playerID);
     this->newPlayerDataLock.unlock();
 }
 
 void GameEngine::removeUser(uint32_t playerID) {
     this->newPlayerDataLock.lock();
-    this->newPlayerData.erase(playerID);
+    this->registeredPlayers.erase(playerID);
+    this->newPlayerInput.erase(playerID);
+    this->pendingPlayerInput.erase(playerID);
+    this->clientClockOffset.erase(playerID);
     this->newPlayerDataLock.unlock();
 }
@@ -4,120 +4,617 @@
 #include <cstdlib>
 #include <ctime>
 #include <random>
+#include <algorithm>
+#include <stdexcept>
 
 bool DEBUG = true;
 
-// Client passes an update of their user data (pose of head and hands)
-void GameServer::updatePlayerData(uint32_t playerID, rpcmsg::PlayerData const & playerData) {
+// Published ticks between snapshots for a client asking for the given rate
+static uint32_t getSnapshotTickInterval(uint32_t snapshotRate) {
+    snapshotRate = std::min(std::max(snapshotRate, (uint32_t)1), (uint32_t)REFRESH_RATE);
+    return std::max((uint32_t)1, (REFRESH_RATE + snapshotRate / 2) / snapshotRate);
+}
+
+// First tick after the given one that falls on the snapshot schedule
+static uint64_t getNextSnapshotTick(uint64_t tick, uint32_t tickInterval) {
+    return (tick / tickInterval + 1) * tickInterval;
+}
+
+// Every procedure answers to its full name and to the compact name made from its ID
+template <typename Function>
+static void bindMethod(rpc::server & rpcServer, rpcmsg::MethodID methodID, Function function) {
+    rpcServer.bind(rpcmsg::METHOD_NAMES[methodID], function);
+    rpcServer.bind(rpcmsg::getCompactMethodName(methodID), function);
+}
+
+// Hand the input samples (pose of head and hands) a player took since their last update,
+// oldest first, to the engine. Shared by every channel input comes in on, so it only says
+// whether the player has a session and leaves answering to the caller
+bool GameServer::applyPlayerInput(uint32_t playerID, std::vector<rpcmsg::InputFrame> const & playerInputSamples) {
+
+    // Check that the user id the user specified is valid, and note that we heard from them
+    if (!this->sessions.touch(playerID, this->getCurrentTime()))
+        return false;
 
-    // Check that the user id the user specified is valid
-    if (this->communicationMetadata.find(playerID) == this->communicationMetadata.end())
-        rpc::this_handler().respond_error(rpcmsg::INVALID_USER);
-    
     // All is good, update the server's data
-    this->gameEngine->handleNewUserInput(playerID, playerData);
-    this->communicationMetadata[playerID].lastCommunicated = this->getCurrentTime();
+    this->gameEngine->handleNewUserInput(playerID, playerInputSamples);
+    return true;
+}
+
+// Client passes their input samples over RPC. This usually comes in as a notification, so
+// nobody is waiting on an answer and an unknown player is dropped
+void GameServer::updatePlayerData(uint32_t playerID, std::vector<rpcmsg::InputFrame> const & playerInputSamples) {
+    if (!this->applyPlayerInput(playerID, playerInputSamples))
+        rpc::this_handler().respond_error(rpcmsg::INVALID_USER);
 }
 
-// Client wants to get a copy of the current state of the game.
-// TODO: Need better way to send custom struct to client from server
-std::vector<char> GameServer::getEntireGameData() {
+// Client wants to get a copy of the current state of the game. The engine packs each
+// tick only once no matter how many clients ask for it, and the packed bytes are handed
+// to rpclib as is rather than being copied into the response
+rpcmsg::SerializedGameData GameServer::getEntireGameData() {
+    rpcmsg::SerializedGameData serializedGameData;
+    serializedGameData.buffer = this->gameEngine->getSerializedGameData();
+    return serializedGameData;
+}
+
+// Client wants whatever changed in the game state since the tick it last received. Falls
+// back to a full snapshot if that tick is no longer kept around. Registered players only
+// get the part of the game that is relevant to them, so their deltas are packed for each
+// request. Everyone else sees the whole game, so a full snapshot is the same for all of them
+// and shares the buffer the engine packs once per tick
+rpcmsg::SerializedGameData GameServer::getGameDataDelta(uint32_t playerID, uint64_t baselineTick) {
+    rpcmsg::SerializedGameData serializedGameData;
+    uint64_t tick;
+    std::shared_ptr<const rpcmsg::GameData> currentGameData = this->gameEngine->getGameDataSnapshot(tick);
+    std::shared_ptr<const rpcmsg::GameData> baselineGameData;
+    if (this->sessions.contains(playerID)) {
+        baselineGameData = this->interestManager->findView(playerID, baselineTick);
+        currentGameData = this->interestManager->buildView(playerID, *currentGameData, tick, baselineGameData.get(), baselineTick, 0);
+    }
+    else {
+        baselineGameData = this->gameEngine->findGameDataSnapshot(baselineTick);
+        if (baselineGameData == nullptr) {
+            serializedGameData.buffer = this->gameEngine->getSerializedFullSnapshot();
+            return serializedGameData;
+        }
+    }
+
     RPCLIB_MSGPACK::sbuffer buffer;
-    RPCLIB_MSGPACK::pack(buffer, this->gameEngine->getCopyOfGameData());
+    RPCLIB_MSGPACK::pack(buffer, rpcmsg::makeGameDataDelta(baselineGameData.get(), baselineTick, *currentGameData, tick));
 
-    std::vector<char> raw_data;
-    raw_data.resize(buffer.size());
-    std::memcpy(raw_data.data(), buffer.data(), buffer.size());
-    return raw_data;
+    serializedGameData.buffer = std::make_shared<const std::vector<char>>(buffer.data(), buffer.data() + buffer.size());
+    return serializedGameData;
 }
 
-// Client wants to join the game. Return a player ID if max user has not exceeded.
-uint32_t GameServer::requestServerSession(const rpcmsg::PlayerData & playerData) {
+// Client only wants the game state if it is newer than the tick they already have. Waits
+// up to the timeout (0 to answer right away) for the engine to publish one, then answers
+// with an empty bin if there still is nothing new. Each wait holds on to an RPC worker, so
+// a tick the engine hasn't reached (left over from an earlier server run, or made up) is
+// answered right away with the current state rather than waited out
+rpcmsg::SerializedGameData GameServer::getGameDataIfNewer(uint64_t tick, uint32_t timeoutMilliseconds) {
+    uint64_t currentTick;
+    this->gameEngine->getGameDataSnapshot(currentTick);
+    if (tick > currentTick)
+        return this->getEntireGameData();
+
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(std::min(timeoutMilliseconds, (uint32_t)LONG_POLL_MAX_MILLISECONDS));
+    if (!this->gameEngine->waitForNewerGameData(tick, timeout))
+        return rpcmsg::SerializedGameData();
+    return this->getEntireGameData();
+}
+
+// Client wants to join the game. Return a player ID and the session token if max user has
+// not exceeded.
+rpcmsg::SessionGrant GameServer::requestServerSession(const rpcmsg::InputFrame & inputFrame) {
     if (DEBUG) std::cout << "Client requestiong game session..." << std::endl;
 
     // Check if user can join
     this->requestSessionLock.lock();
-    if (this->communicationMetadata.size() >= MAX_PLAYER) {
+    if (this->sessions.size() >= MAX_PLAYER) {
         this->requestSessionLock.unlock();
         if (DEBUG) std::cout << std::endl << "\tCannot register anymore players!" << std::endl;
         rpc::this_handler().respond_error(rpcmsg::MAX_USER_EXCEEDED);
+        return rpcmsg::SessionGrant();
     }
 
-    // Create a new session for the user
-    uint32_t playerID;
+    // Create a new session for the user. The token is drawn straight from the random device
+    // so it can't be guessed from the player ID
+    rpcmsg::SessionGrant sessionGrant;
     std::random_device randomDevice;
     std::mt19937_64 randomGenerator(randomDevice());
     std::uniform_int_distribution<unsigned long> distribution;
     do {
-        playerID = (uint32_t)distribution(randomGenerator);
-    } while ((playerID == 0) || (this->communicationMetadata.find(playerID) != this->communicationMetadata.end()));
-    this->communicationMetadata[playerID] = { playerID, this->getCurrentTime() };
-    this->updatePlayerData(playerID, playerData);
+        sessionGrant.playerID = (uint32_t)distribution(randomGenerator);
+        sessionGrant.sessionToken = ((uint64_t)randomDevice() << 32) | randomDevice();
+    } while ((sessionGrant.playerID == 0) || (sessionGrant.sessionToken == 0) ||
+        (!this->sessions.add(sessionGrant.playerID, sessionGrant.sessionToken, this->getCurrentTime())));
+    this->scheduleSessionTimeout(sessionGrant.playerID, this->getCurrentTime());
+    this->gameEngine->addUser(sessionGrant.playerID);
+    this->updatePlayerData(sessionGrant.playerID, std::vector<rpcmsg::InputFrame>(1, inputFrame));
 
     // Return the player's ID number
-    if (DEBUG) std::cout << "\tNew player ID " << playerID << " registered" << std::endl;
+    if (DEBUG) std::cout << "\tNew player ID " << sessionGrant.playerID << " registered" << std::endl;
     this->requestSessionLock.unlock();
-    return playerID;
+    return sessionGrant;
+}
+
+// Sessions are spread across the event loops by player ID. Returns 0 when there are none,
+// in which case the client stays on the main port
+uint16_t GameServer::getSessionLoopPort(uint32_t playerID) {
+    if (this->loopServers.empty() || (!this->sessions.contains(playerID)))
+        return 0;
+    return (uint16_t)(this->portNumber + RPC_LOOP_PORT_OFFSET + (playerID % this->loopServers.size()));
+}
+
+// Client on the same host wants to hand us their input through shared memory. Returns the
+// name of the ring to write it to. Every client sees every player ID in the snapshots, so
+// only the session token gets a ring handed out
+std::string GameServer::openLocalInput(uint32_t playerID, uint64_t sessionToken) {
+    if (!this->sessions.authenticate(playerID, sessionToken)) {
+        rpc::this_handler().respond_error(rpcmsg::INVALID_USER);
+        return std::string();
+    }
+
+    std::string ringName = getInputRingName(this->portNumber, playerID);
+    std::lock_guard<std::mutex> lock(this->localInputRingsLock);
+    if (this->localInputRings.find(playerID) == this->localInputRings.end()) {
+        std::unique_ptr<InputRing> inputRing = std::make_unique<InputRing>();
+        if (!inputRing->create(ringName)) {
+            rpc::this_handler().respond_error(std::string("Unable to create ") + ringName);
+            return std::string();
+        }
+        this->localInputRings[playerID] = std::move(inputRing);
+    }
+    return ringName;
+}
+
+// Client asks for snapshots to be pushed at the given rate. They go out on the engine's
+// publish schedule, every so many ticks, so the closest rate that divides evenly into
+// it is what the client gets
+rpcmsg::SnapshotSchedule GameServer::negotiateSnapshotRate(uint32_t playerID, uint32_t snapshotRate) {
+    rpcmsg::SnapshotSchedule snapshotSchedule = { REFRESH_RATE, getSnapshotTickInterval(snapshotRate) };
+    if (!this->sessions.setSnapshotTickInterval(playerID, snapshotSchedule.tickInterval))
+        rpc::this_handler().respond_error(rpcmsg::INVALID_USER);
+    return snapshotSchedule;
+}
+
+// The negotiated snapshot interval for the session, or the one closest to the rate the
+// client asked for on the channel if they never negotiated
+uint32_t GameServer::getSessionTickInterval(uint32_t playerID, uint32_t requestedSnapshotRate) {
+    uint32_t tickInterval = this->sessions.getSnapshotTickInterval(playerID);
+    return (tickInterval != 0) ? tickInterval : getSnapshotTickInterval(requestedSnapshotRate);
 }
 
 // Client has exited the game. Close the client's session
 void GameServer::closeServerSession(uint32_t playerID) {
     if (DEBUG) std::cout << "Ending session for player " << playerID << std::endl;
-    this->communicationMetadata.erase(playerID);
+    this->sessions.remove(playerID);
     this->gameEngine->removeUser(playerID);
+    this->interestManager->removePlayer(playerID);
 }
 
-// Periodically check if a player disconnected and close their session
+uint64_t GameServer::getMaintenanceTick(std::chrono::nanoseconds time) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(time).count() / MAINTENANCE_TIMER_MILLISECONDS;
+}
+
+// Check on the session once it would have timed out if nothing is heard from it after the
+// given time. Heartbeats only stamp the session, they don't touch the wheel
+void GameServer::scheduleSessionTimeout(uint32_t playerID, std::chrono::nanoseconds lastCommunicated) {
+    uint64_t dueTick = this->getMaintenanceTick(lastCommunicated + std::chrono::seconds(TIMEOUT_SECONDS)) + 1;
+    std::lock_guard<std::mutex> lock(this->sessionTimeoutsLock);
+    this->sessionTimeouts->schedule(dueTick, EVENT_SESSION_TIMEOUT, playerID);
+}
+
+// Periodically check if a player disconnected and close their session. Only sessions whose
+// timeout came due are looked at. Those that were heard from since get checked again once
+// their new timeout comes due, the rest are closed. Closed sessions are freed here too, a
+// period after they were removed
 void GameServer::serverPeriodicMaintenance() {
     while (this->serverActive) {
+        this->sessions.reclaimRetiredSessions();
 
         std::chrono::nanoseconds currentTime = this->getCurrentTime();
-        auto communicationMetaInstance = this->communicationMetadata;
-        for (auto connection = communicationMetaInstance.begin(); connection != communicationMetaInstance.end(); connection++) {
-            std::chrono::seconds duration = std::chrono::duration_cast<std::chrono::seconds>(currentTime - connection->second.lastCommunicated);
-            if (duration.count() > TIMEOUT_SECONDS)
-                this->closeServerSession(connection->second.playerID);
+        std::vector<TimingWheel::Event> dueEvents;
+        this->sessionTimeoutsLock.lock();
+        this->sessionTimeouts->advance(this->getMaintenanceTick(currentTime), dueEvents);
+        this->sessionTimeoutsLock.unlock();
+
+        for (auto event = dueEvents.begin(); event != dueEvents.end(); event++) {
+            std::chrono::nanoseconds lastCommunicated;
+            if (!this->sessions.getLastCommunicated(event->entityID, lastCommunicated))
+                continue;
+            if (currentTime - lastCommunicated > std::chrono::seconds(TIMEOUT_SECONDS))
+                this->closeServerSession(event->entityID);
+            else
+                this->scheduleSessionTimeout(event->entityID, lastCommunicated);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(MAINTENANCE_TIMER_MILLISECONDS));
+    }
+}
+
+// Hand every client that connects to the snapshot stream its own pushing thread
+void GameServer::acceptSnapshotSubscribers() {
+    uint32_t retryMilliseconds = STREAM_ACCEPT_RETRY_MIN_MILLISECONDS;
+    while (this->serverActive) {
+        std::unique_ptr<SocketStream> stream = this->snapshotListener->accept();
+
+        // Only shutting down ends the loop. Running out of descriptors or a client hanging up
+        // before we got to it just fails this accept, so wait a bit and carry on
+        if (stream == nullptr) {
+            if ((!this->serverActive) || (!this->snapshotListener->isOpen()))
+                break;
+            std::cerr << "\tUnable to accept snapshot subscriber, retrying in " << retryMilliseconds << " ms" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(retryMilliseconds));
+            retryMilliseconds = std::min(retryMilliseconds * 2, (uint32_t)STREAM_ACCEPT_RETRY_MAX_MILLISECONDS);
+            continue;
+        }
+        retryMilliseconds = STREAM_ACCEPT_RETRY_MIN_MILLISECONDS;
+
+        std::lock_guard<std::mutex> lock(this->snapshotSubscribersLock);
+
+        // Clean up after subscribers that have gone away
+        for (auto subscriber = this->snapshotSubscribers.begin(); subscriber != this->snapshotSubscribers.end();) {
+            if ((*subscriber)->finished) {
+                (*subscriber)->thread.join();
+                subscriber = this->snapshotSubscribers.erase(subscriber);
+            }
+            else
+                subscriber++;
+        }
+
+        std::unique_ptr<SnapshotSubscriber> subscriber = std::make_unique<SnapshotSubscriber>();
+        subscriber->stream = std::move(stream);
+        subscriber->finished = false;
+        subscriber->thread = std::thread(&GameServer::pushSnapshots, this, subscriber.get());
+        this->snapshotSubscribers.push_back(std::move(subscriber));
+    }
+}
+
+// Push each newly published tick to the subscriber at the rate they asked for. The stream
+// is ordered and reliable, so every frame is a delta against the one sent before it
+void GameServer::pushSnapshots(SnapshotSubscriber * subscriber) {
+
+    // The client starts by telling us who they are and how often they want snapshots. Only
+    // the session token proves they are who they say
+    rpcmsg::SnapshotSubscription subscription;
+    std::vector<char> frame;
+    try {
+        if (!subscriber->stream->receiveFrame(frame))
+            throw std::runtime_error("Snapshot subscription not received");
+        RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(frame.data(), frame.size());
+        oh.get().convert(subscription);
+        if (!this->sessions.authenticate(subscription.playerID, subscription.sessionToken))
+            throw std::runtime_error("Snapshot subscription not authenticated");
+    }
+    catch (const std::exception&) {
+        subscriber->stream->close();
+        subscriber->finished = true;
+        return;
+    }
+
+    uint32_t playerID = subscription.playerID;
+    if (DEBUG) std::cout << "Player " << playerID << " subscribed to snapshots every " <<
+        this->getSessionTickInterval(playerID, subscription.snapshotRate) << " ticks" <<
+        ((subscription.snapshotByteBudget > 0) ? ", " + std::to_string(subscription.snapshotByteBudget) + " bytes each" : "") << std::endl;
+
+    // Writing happens on its own thread so a slow client never holds up building the next snapshot
+    subscriber->stream->setSendBufferSize(STREAM_SEND_BUFFER_BYTES);
+    subscriber->outbox = std::make_unique<SnapshotOutbox>(STREAM_MAX_CONTROL_MESSAGES);
+    subscriber->writerThread = std::thread(&GameServer::writeSnapshots, this, subscriber, subscription);
+
+    uint64_t nextSnapshotTick = 1;
+    while (this->serverActive && subscriber->stream->isOpen() && this->sessions.contains(playerID)) {
+
+        // Hand over the first tick published at or after the one that is due. The interval
+        // is looked up every time so a renegotiated rate takes effect right away
+        uint32_t tickInterval = this->getSessionTickInterval(playerID, subscription.snapshotRate);
+        std::chrono::nanoseconds timeout = std::chrono::nanoseconds(NANOSECONDS_IN_SECOND / REFRESH_RATE) * tickInterval;
+        if (this->gameEngine->waitForNewerGameData(nextSnapshotTick - 1, timeout)) {
+            uint64_t tick;
+            std::shared_ptr<const rpcmsg::GameData> gameData = this->gameEngine->getGameDataSnapshot(tick);
+            subscriber->outbox->offerSnapshot(gameData, tick);
+            nextSnapshotTick = getNextSnapshotTick(tick, tickInterval);
+        }
+    }
+
+    // Let the client know if their session went away rather than just hanging up on them
+    if (this->serverActive && (!this->sessions.contains(playerID))) {
+        RPCLIB_MSGPACK::sbuffer buffer;
+        RPCLIB_MSGPACK::pack(buffer, rpcmsg::StreamControl{ STREAM_CONTROL_SESSION_CLOSED });
+        subscriber->outbox->queueControlMessage(std::vector<char>(buffer.data(), buffer.data() + buffer.size()));
+    }
+    subscriber->outbox->close();
+    subscriber->writerThread.join();
+
+    if (DEBUG) std::cout << "Snapshot stream for player " << playerID << " closed ("
+        << subscriber->outbox->getOverwrittenSnapshots() << " snapshots skipped)" << std::endl;
+    subscriber->stream->close();
+    subscriber->finished = true;
+}
+
+// Write whatever is in the subscriber's outbox. Snapshots go out as a delta against the
+// last one actually written, however many were skipped in between. The player's view is
+// only built here, against that same baseline, so the byte budget is measured against the
+// delta that really goes out and views that get overwritten are never built
+void GameServer::writeSnapshots(SnapshotSubscriber * subscriber, rpcmsg::SnapshotSubscription subscription) {
+    std::shared_ptr<const rpcmsg::GameData> lastSentView;
+    uint64_t lastSentTick = 0;
+    SnapshotOutbox::Message message;
+    while (subscriber->outbox->waitForMessage(message)) {
+        if (message.isControl) {
+            if (!subscriber->stream->sendFrame(message.control.data(), message.control.size()))
+                break;
+            continue;
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(MAINTENANCE_TIMER_SECONDS));
+        std::shared_ptr<const rpcmsg::GameData> view = this->interestManager->buildView(subscription.playerID,
+            *message.gameData, message.tick, lastSentView.get(), lastSentTick, subscription.snapshotByteBudget);
+        RPCLIB_MSGPACK::sbuffer buffer;
+        RPCLIB_MSGPACK::pack(buffer, rpcmsg::makeGameDataDelta(lastSentView.get(), lastSentTick, *view, message.tick));
+        if (!subscriber->stream->sendFrame(buffer.data(), buffer.size()))
+            break;
+
+        lastSentView = std::move(view);
+        lastSentTick = message.tick;
+    }
+
+    // The stream is no good anymore. Closing it also stops the subscriber's pushing thread
+    subscriber->outbox->close();
+    subscriber->stream->close();
+}
+
+// Take in input datagrams. Whoever sends them for a registered player gets snapshot
+// datagrams back at the rate they asked for
+void GameServer::receiveDatagrams() {
+    std::vector<char> datagram;
+    DatagramEndpoint endpoint;
+    while (this->serverActive && this->datagramSocket->isOpen()) {
+        if (!this->datagramSocket->receiveFrom(datagram, endpoint))
+            continue;
+
+        rpcmsg::InputDatagram inputDatagram;
+        try {
+            RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(datagram.data(), datagram.size());
+            oh.get().convert(inputDatagram);
+        }
+        catch (const std::exception&) {
+            continue;
+        }
+
+        // Sessions are only opened and closed over RPC. Anyone can put any player ID and source
+        // address on a datagram, so only the session token lets it in or moves the peer
+        // The session can still close right after, in which case the input is dropped too
+        if ((!this->sessions.authenticate(inputDatagram.playerID, inputDatagram.sessionToken)) ||
+            (!this->applyPlayerInput(inputDatagram.playerID, inputDatagram.inputFrames)))
+            continue;
+
+        uint32_t tickInterval = this->getSessionTickInterval(inputDatagram.playerID, inputDatagram.snapshotRate);
+        std::lock_guard<std::mutex> lock(this->datagramPeersLock);
+        auto peer = this->datagramPeers.find(inputDatagram.playerID);
+        if (peer == this->datagramPeers.end()) {
+            if (DEBUG) std::cout << "Player " << inputDatagram.playerID << " switched to datagrams every " << tickInterval << " ticks" << std::endl;
+            peer = this->datagramPeers.insert({ inputDatagram.playerID, { endpoint, 0, 0, 0, 0 } }).first;
+        }
+
+        // Datagrams can arrive out of order. Never go back to an older baseline
+        peer->second.endpoint = endpoint;
+        peer->second.acknowledgedTick = std::max(peer->second.acknowledgedTick, inputDatagram.acknowledgedTick);
+        peer->second.tickInterval = tickInterval;
+        peer->second.snapshotByteBudget = inputDatagram.snapshotByteBudget;
     }
 }
 
-GameServer::GameServer(int portNumber)
+// Send each datagram peer that is due a delta against the newest tick they told us they
+// have. If that got lost on the way, the next one is simply made against an older tick
+void GameServer::sendSnapshotDatagrams() {
+    uint64_t lastTick = 0;
+    while (this->serverActive) {
+        if (!this->gameEngine->waitForNewerGameData(lastTick, std::chrono::milliseconds(DATAGRAM_RECEIVE_TIMEOUT_MS)))
+            continue;
+        std::shared_ptr<const rpcmsg::GameData> gameData = this->gameEngine->getGameDataSnapshot(lastTick);
+
+        // Find out who is due a snapshot, and forget about peers whose session has ended
+        std::vector<std::pair<uint32_t, DatagramPeer>> duePeers;
+        this->datagramPeersLock.lock();
+        for (auto peer = this->datagramPeers.begin(); peer != this->datagramPeers.end();) {
+            if (!this->sessions.contains(peer->first)) {
+                peer = this->datagramPeers.erase(peer);
+                continue;
+            }
+            if (lastTick >= peer->second.nextSnapshotTick) {
+                peer->second.nextSnapshotTick = getNextSnapshotTick(lastTick, peer->second.tickInterval);
+                duePeers.push_back(*peer);
+            }
+            peer++;
+        }
+        this->datagramPeersLock.unlock();
+
+        for (auto peer = duePeers.begin(); peer != duePeers.end(); peer++) {
+            uint32_t playerID = peer->first;
+            uint64_t baselineTick = peer->second.acknowledgedTick;
+            std::shared_ptr<const rpcmsg::GameData> baselineView = this->interestManager->findView(playerID, baselineTick);
+            std::shared_ptr<const rpcmsg::GameData> view =
+                this->interestManager->buildView(playerID, *gameData, lastTick, baselineView.get(), baselineTick,
+                    peer->second.snapshotByteBudget);
+
+            RPCLIB_MSGPACK::sbuffer buffer;
+            RPCLIB_MSGPACK::pack(buffer, rpcmsg::makeGameDataDelta(baselineView.get(), baselineTick, *view, lastTick));
+            if ((!this->datagramSocket->sendTo(peer->second.endpoint, buffer.data(), buffer.size())) && DEBUG)
+                std::cout << "Unable to send " << buffer.size() << " byte snapshot datagram to player " << playerID << std::endl;
+        }
+    }
+}
+
+// Copy each published tick into the shared snapshot ring while a local reader has it open,
+// and pass on whatever input local clients left in their rings. Without a reader nothing is
+// packed, so ticks nobody asks for still cost nothing
+void GameServer::serveSharedMemory() {
+    std::chrono::nanoseconds tickDuration = std::chrono::nanoseconds(NANOSECONDS_IN_SECOND / REFRESH_RATE);
+    uint64_t lastTick = 0;
+    std::vector<char> message;
+    while (this->serverActive) {
+        if (this->gameEngine->waitForNewerGameData(lastTick, tickDuration)) {
+            this->gameEngine->getGameDataSnapshot(lastTick);
+            if (this->sharedSnapshots->hasReaders()) {
+                std::shared_ptr<const std::vector<char>> serializedGameData = this->gameEngine->getSerializedGameData();
+                if ((!this->sharedSnapshots->publish(serializedGameData->data(), serializedGameData->size())) && DEBUG)
+                    std::cout << "Snapshot of " << serializedGameData->size() << " bytes does not fit in shared memory" << std::endl;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(this->localInputRingsLock);
+        for (auto inputRing = this->localInputRings.begin(); inputRing != this->localInputRings.end();) {
+            if (!this->sessions.contains(inputRing->first)) {
+                inputRing = this->localInputRings.erase(inputRing);
+                continue;
+            }
+
+            std::vector<rpcmsg::InputFrame> inputFrames;
+            while (inputRing->second->pop(message)) {
+                try {
+                    RPCLIB_MSGPACK::object_handle oh = RPCLIB_MSGPACK::unpack(message.data(), message.size());
+                    inputFrames.push_back(oh.get().as<rpcmsg::InputFrame>());
+                }
+                catch (const std::exception&) {
+                }
+            }
+            if (!inputFrames.empty())
+                this->applyPlayerInput(inputRing->first, inputFrames);
+            inputRing++;
+        }
+    }
+}
+
+GameServer::GameServer(int portNumber, bool hordeMode)
 {
+    this->portNumber = portNumber;
+
     // Start the game server update service
-    this->gameEngine = std::make_unique<GameEngine>();
+    this->gameEngine = std::make_unique<GameEngine>(hordeMode);
+    this->interestManager = std::make_unique<InterestManager>();
 
     // Instantiate a new server object
     this->server = std::make_unique<rpc::server>(portNumber);
     this->serverActive = true;
+    this->bindRemoteProcedures(*this->server);
+
+    // Listen for clients that want snapshots pushed to them instead of polling for them
+    this->snapshotListener = std::make_unique<SocketListener>();
+    if (this->snapshotListener->listen(portNumber + SNAPSHOT_STREAM_PORT_OFFSET))
+        this->snapshotAcceptThread = std::thread(&GameServer::acceptSnapshotSubscribers, this);
+    else
+        std::cerr << "\tUnable to open snapshot stream on port " << portNumber + SNAPSHOT_STREAM_PORT_OFFSET << std::endl;
+
+    // Clients can also switch over to datagrams for input and snapshots
+    this->datagramSocket = std::make_unique<DatagramSocket>();
+    this->datagramSocket->setSimulatedLoss(DATAGRAM_SIMULATED_LOSS);
+    if (this->datagramSocket->open(portNumber + DATAGRAM_PORT_OFFSET)) {
+        this->datagramReceiveThread = std::thread(&GameServer::receiveDatagrams, this);
+        this->datagramSendThread = std::thread(&GameServer::sendSnapshotDatagrams, this);
+    }
+    else
+        std::cerr << "\tUnable to open datagram channel on port " << portNumber + DATAGRAM_PORT_OFFSET << std::endl;
+
+    // Local clients and tools can skip the network altogether
+    this->sharedSnapshots = std::make_unique<SnapshotRing>();
+    if (this->sharedSnapshots->create(getSnapshotRingName(portNumber)))
+        this->sharedMemoryThread = std::thread(&GameServer::serveSharedMemory, this);
+    else
+        std::cerr << "\tUnable to create shared snapshot ring" << std::endl;
+
+    // Create thread that periodically monitors connection status with client
+    this->sessionTimeouts = std::make_unique<TimingWheel>(this->getMaintenanceTick(this->getCurrentTime()));
+    std::thread serverMaintenanceThread = std::thread(&GameServer::serverPeriodicMaintenance, this);
+    serverMaintenanceThread.detach();
+
+    // Spawn multiple worker to handle client requests
+    this->server->async_run(NUM_WORKER);
+    if (PER_CORE_RPC_LOOPS)
+        this->startRpcLoops();
+    std::cout << "\tServer is up and running" << std::endl;
+}
+
+// Procedures a session calls while it is playing. These are all that the event loops serve,
+// so nothing on a loop can block its only thread
+void GameServer::bindSessionProcedures(rpc::server & rpcServer) {
 
     // Bind function to update server's player data
-    this->server->bind(rpcmsg::UPDATE_PLAYER_DATA, 
-        [this](uint32_t playerID, rpcmsg::PlayerData const & playerData) {
-        this->updatePlayerData(playerID, playerData); });
+    bindMethod(rpcServer, rpcmsg::METHOD_UPDATE_PLAYER_DATA,
+        [this](uint32_t playerID, std::vector<rpcmsg::InputFrame> const & playerInputSamples) {
+        this->updatePlayerData(playerID, playerInputSamples); });
+
+    // Bind function to return the changes to the game state since the client's last copy
+    bindMethod(rpcServer, rpcmsg::METHOD_GET_GAME_DATA_DELTA, [this](uint32_t playerID, uint64_t baselineTick) {
+        return this->getGameDataDelta(playerID, baselineTick);
+    });
+
+    // Bind function to allow a client on the same host to send input through shared memory
+    bindMethod(rpcServer, rpcmsg::METHOD_OPEN_LOCAL_INPUT, [this](uint32_t playerID, uint64_t sessionToken) {
+        return this->openLocalInput(playerID, sessionToken); });
+
+    // Bind function to settle on how often snapshots are pushed to the client
+    bindMethod(rpcServer, rpcmsg::METHOD_NEGOTIATE_SNAPSHOT_RATE, [this](uint32_t playerID, uint32_t snapshotRate) {
+        return this->negotiateSnapshotRate(playerID, snapshotRate); });
+}
+
+// Everything the main server answers to: the session procedures, plus opening and closing
+// sessions, full game state and the long poll, which may hold a worker for a while
+void GameServer::bindRemoteProcedures(rpc::server & rpcServer) {
+    this->bindSessionProcedures(rpcServer);
 
     // Bind function to return server's game state to client
-    this->server->bind(rpcmsg::GET_GAME_DATA, [this]() {
+    bindMethod(rpcServer, rpcmsg::METHOD_GET_GAME_DATA, [this]() {
         return this->getEntireGameData();
     });
 
+    // Bind function to return server's game state to client only once it has moved past their tick
+    bindMethod(rpcServer, rpcmsg::METHOD_GET_GAME_DATA_IF_NEWER, [this](uint64_t tick, uint32_t timeoutMilliseconds) {
+        return this->getGameDataIfNewer(tick, timeoutMilliseconds);
+    });
+
     // Bind function to allow client to join the game
-    this->server->bind(rpcmsg::REQUEST_SERVER_SESSION,
-        [this](const rpcmsg::PlayerData & playerData) {
-        return this->requestServerSession(playerData); });
+    bindMethod(rpcServer, rpcmsg::METHOD_REQUEST_SERVER_SESSION,
+        [this](const rpcmsg::InputFrame & inputFrame) {
+        return this->requestServerSession(inputFrame); });
+
+    // Bind function to tell a client which event loop its session is pinned to
+    bindMethod(rpcServer, rpcmsg::METHOD_GET_SESSION_LOOP_PORT, [this](uint32_t playerID) {
+        return this->getSessionLoopPort(playerID); });
 
     // Bind function to allow client to leave game session
-    this->server->bind(rpcmsg::CLOSE_SERVER_SESSION, [this](uint32_t playerID) {
+    bindMethod(rpcServer, rpcmsg::METHOD_CLOSE_SERVER_SESSION, [this](uint32_t playerID) {
         this->closeServerSession(playerID); });
 
-    // Create thread that periodically monitors connection status with client
-    std::thread serverMaintenanceThread = std::thread(&GameServer::serverPeriodicMaintenance, this);
-    serverMaintenanceThread.detach();
+    // Bind function to hand out the IDs of the procedures above, keyed by their full name
+    rpcServer.bind(rpcmsg::GET_METHOD_IDS, []() {
+        std::unordered_map<std::string, uint32_t> methodIDs;
+        for (uint32_t methodID = 0; methodID < rpcmsg::METHOD_COUNT; methodID++)
+            methodIDs[rpcmsg::METHOD_NAMES[methodID]] = methodID;
+        return methodIDs;
+    });
+}
 
-    // Spawn multiple worker to handle client requests
-    this->server->async_run(NUM_WORKER);
-    std::cout << "\tServer is up and running" << std::endl;
+// Start one single threaded RPC server per core. rpclib binds its acceptor itself, so the
+// loops can't share a port through SO_REUSEPORT. Each listens on its own port instead and
+// clients are pointed at theirs once they have a session. With one thread per loop every
+// request of a session is handled on the same thread, without contending with other loops
+void GameServer::startRpcLoops() {
+    unsigned int loopCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int loop = 0; loop < loopCount; loop++) {
+        int loopPort = this->portNumber + RPC_LOOP_PORT_OFFSET + loop;
+        try {
+            std::unique_ptr<rpc::server> loopServer = std::make_unique<rpc::server>(loopPort);
+            this->bindSessionProcedures(*loopServer);
+            loopServer->async_run(1);
+            this->loopServers.push_back(std::move(loopServer));
+        }
+        catch (const std::exception&) {
+            std::cerr << "\tUnable to open RPC event loop on port " << loopPort << std::endl;
+            break;
+        }
+    }
+    std::cout << "\tServing sessions on " << this->loopServers.size() << " RPC event loops" << std::endl;
 }
 
 std::chrono::nanoseconds GameServer::getCurrentTime() {
@@ -133,6 +630,36 @@ GameServer::~GameServer()
 
 void GameServer::stop() {
     this->serverActive = false;
+
+    // Stop pushing snapshots before the engine goes away
+    this->snapshotListener->close();
+    if (this->snapshotAcceptThread.joinable())
+        this->snapshotAcceptThread.join();
+    this->snapshotSubscribersLock.lock();
+    for (auto subscriber = this->snapshotSubscribers.begin(); subscriber != this->snapshotSubscribers.end(); subscriber++) {
+        (*subscriber)->stream->close();
+        (*subscriber)->thread.join();
+    }
+    this->snapshotSubscribers.clear();
+    this->snapshotSubscribersLock.unlock();
+    if (this->datagramReceiveThread.joinable())
+        this->datagramReceiveThread.join();
+    if (this->datagramSendThread.joinable())
+        this->datagramSendThread.join();
+    this->datagramSocket->close();
+    if (this->sharedMemoryThread.joinable())
+        this->sharedMemoryThread.join();
+    this->sharedSnapshots->close();
+    this->localInputRingsLock.lock();
+    this->localInputRings.clear();
+    this->localInputRingsLock.unlock();
+
+    for (auto loopServer = this->loopServers.begin(); loopServer != this->loopServers.end(); loopServer++) {
+        (*loopServer)->close_sessions();
+        (*loopServer)->stop();
+    }
+    this->loopServers.clear();
+
     this->server->close_sessions();
     this->server->stop();
     this->server.reset();
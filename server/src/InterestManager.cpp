@@ -0,0 +1,284 @@
+#include "InterestManager.hpp"
+#include "SnapshotDelta.hpp"
+#include "rpc/config.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define INTEREST_FULL    0
+#define INTEREST_REDUCED 1
+#define INTEREST_NONE    2
+
+// How much the player cares about something at the given position
+static int classifyInterest(const glm::vec3 & position, const glm::vec3 & headPosition,
+    const glm::vec3 & headForward, float & distance)
+{
+    glm::vec3 offset = position - headPosition;
+    distance = glm::length(offset);
+    if (distance < INTEREST_NEAR_DISTANCE)
+        return INTEREST_FULL;
+    if (glm::dot(offset / distance, headForward) > std::cos(INTEREST_VIEW_HALF_ANGLE))
+        return INTEREST_FULL;
+    return (distance < INTEREST_FAR_DISTANCE) ? INTEREST_REDUCED : INTEREST_NONE;
+}
+
+// Out of view entities take turns being refreshed, spread out by their entity ID
+static bool isRefreshDue(uint32_t entityID, uint64_t tick, uint64_t baselineTick)
+{
+    return ((tick + entityID) / INTEREST_REDUCED_INTERVAL) != ((baselineTick + entityID) / INTEREST_REDUCED_INTERVAL);
+}
+
+#define CATEGORY_PLAYER             0
+#define CATEGORY_CASTLE_CRASHER     1
+#define CATEGORY_FLYING_ARROW       2
+#define CATEGORY_MULTIPLIER_DISPLAY 3
+
+// Which version of an entity goes into the view
+template <typename T>
+struct EntitySelection {
+    uint32_t  entityID;
+    float     distance;
+    float     priority;
+    const T * current;
+    const T * baseline;     // Version the player already has, if any
+    bool      refresh;      // Send the current version rather than the baseline one
+};
+
+// Something that changed and is waiting for room in the byte budget
+struct BudgetCandidate {
+    float    priority;
+    size_t   cost;
+    uint64_t key;
+    bool *   refresh;
+};
+
+// Pick which version of each entity goes into the view. Entities without a position are
+// always of full interest
+template <typename T>
+static std::vector<EntitySelection<T>> selectEntities(const std::list<T> & entities,
+    const std::list<T> * baselineEntities, const glm::vec3 & headPosition, const glm::vec3 & headForward,
+    uint64_t tick, uint64_t baselineTick, glm::vec3 (*getPosition)(const T &), float fullPriority, float reducedPriority)
+{
+    std::unordered_map<uint32_t, const T *> baseline;
+    if (baselineEntities != nullptr)
+        for (auto entity = baselineEntities->begin(); entity != baselineEntities->end(); entity++)
+            baseline[entity->entityID] = &(*entity);
+
+    std::vector<EntitySelection<T>> selected;
+    for (auto entity = entities.begin(); entity != entities.end(); entity++) {
+        float distance = 0.0f;
+        int interest = (getPosition != nullptr) ?
+            classifyInterest(getPosition(*entity), headPosition, headForward, distance) : INTEREST_FULL;
+        if (interest == INTEREST_NONE)
+            continue;
+
+        // Keep sending the old copy until this entity's turn comes up
+        auto baselineEntity = baseline.find(entity->entityID);
+        const T * baselineCopy = (baselineEntity != baseline.end()) ? baselineEntity->second : nullptr;
+        bool refresh = (interest == INTEREST_FULL) || (baselineCopy == nullptr) || isRefreshDue(entity->entityID, tick, baselineTick);
+        float priority = (interest == INTEREST_FULL) ? fullPriority : reducedPriority;
+        selected.push_back({ entity->entityID, distance, priority, &(*entity), baselineCopy, refresh });
+    }
+    return selected;
+}
+
+// Bytes the entity adds to a delta against the version the player has
+template <typename T>
+static size_t measureDelta(uint32_t entityID, const T * baseline, const T & current, RPCLIB_MSGPACK::sbuffer & scratch)
+{
+    uint32_t fieldMask = (baseline != nullptr) ? rpcmsg::diffFields(*baseline, current) : rpcmsg::allFields<T>();
+    if (fieldMask == 0)
+        return 0;
+
+    rpcmsg::EntityDelta<T> delta = { entityID, fieldMask, current };
+    scratch.clear();
+    RPCLIB_MSGPACK::pack(scratch, delta);
+    return scratch.size();
+}
+
+// Put every changed entity that is due up for the budget, with a priority that grows the
+// longer it has been waiting. Entities with nothing to send count as refreshed
+template <typename T>
+static void addBudgetCandidates(std::vector<EntitySelection<T>> & selections, uint32_t category, uint64_t tick,
+    const std::unordered_map<uint64_t, uint64_t> & refreshedTicks, std::unordered_map<uint64_t, uint64_t> & newRefreshedTicks,
+    std::vector<BudgetCandidate> & candidates, RPCLIB_MSGPACK::sbuffer & scratch)
+{
+    for (auto selection = selections.begin(); selection != selections.end(); selection++) {
+        uint64_t key = ((uint64_t)category << 32) | selection->entityID;
+        auto refreshedTick = refreshedTicks.find(key);
+        uint64_t waitingSince = (refreshedTick != refreshedTicks.end()) ? refreshedTick->second : tick;
+        newRefreshedTicks[key] = waitingSince;
+        if (!selection->refresh)
+            continue;
+
+        size_t cost = measureDelta(selection->entityID, selection->baseline, *selection->current, scratch);
+        if (cost == 0) {
+            newRefreshedTicks[key] = tick;
+            continue;
+        }
+
+        // Only refreshed if the budget says so
+        selection->refresh = false;
+        float priority = selection->priority + PRIORITY_PER_STALE_TICK * (float)(tick - waitingSince);
+        candidates.push_back({ priority, cost, key, &selection->refresh });
+    }
+}
+
+template <typename T>
+static void addSelectedEntities(const std::vector<EntitySelection<T>> & selections, std::list<T> & entities)
+{
+    for (auto selection = selections.begin(); selection != selections.end(); selection++) {
+        const T * entity = selection->refresh ? selection->current : selection->baseline;
+        if (entity != nullptr)
+            entities.push_back(*entity);
+    }
+}
+
+static glm::vec3 getCastleCrasherPosition(const rpcmsg::CastleCrasherData & castleCrasher)
+{
+    return rpcmsg::rpcToGLM(castleCrasher.position);
+}
+
+static glm::vec3 getMultiplierDisplayPosition(const rpcmsg::MultiplierDisplayData & multiplierDisplay)
+{
+    return glm::vec3(rpcmsg::rpcToGLM(multiplierDisplay.pose)[3]);
+}
+
+InterestManager::InterestManager()
+{
+}
+
+std::shared_ptr<const rpcmsg::GameData> InterestManager::findView(uint32_t playerID, uint64_t tick)
+{
+    std::lock_guard<std::mutex> playerViewsGuard(this->playerViewsLock);
+    auto player = this->playerViews.find(playerID);
+    if ((tick == 0) || (player == this->playerViews.end()))
+        return nullptr;
+
+    size_t index = tick % INTEREST_VIEW_HISTORY_SIZE;
+    return (player->second.ticks[index] == tick) ? player->second.views[index] : nullptr;
+}
+
+std::shared_ptr<const rpcmsg::GameData> InterestManager::buildView(uint32_t playerID, const rpcmsg::GameData & gameData,
+    uint64_t tick, const rpcmsg::GameData * baselineView, uint64_t baselineTick, size_t byteBudget)
+{
+    std::shared_ptr<rpcmsg::GameData> view = std::make_shared<rpcmsg::GameData>();
+    view->tick = gameData.tick;
+    rpcmsg::copyFields(rpcmsg::allFields<rpcmsg::GameState>(), gameData.gameState, view->gameState);
+
+    // Without a head pose there is nothing to filter by
+    std::unordered_map<uint64_t, uint64_t> refreshedTicks;
+    auto player = gameData.playerData.find(playerID);
+    if (player == gameData.playerData.end()) {
+        view->playerData = gameData.playerData;
+        view->gameState.flyingArrows = gameData.gameState.flyingArrows;
+        view->gameState.castleCrasherData = gameData.gameState.castleCrasherData;
+        view->gameState.multiplierDisplayData = gameData.gameState.multiplierDisplayData;
+    }
+    else {
+        glm::mat4 headPose = rpcmsg::rpcToGLM(player->second.headData.headPose);
+        glm::vec3 headPosition = glm::vec3(headPose[3]);
+        glm::vec3 headForward = glm::normalize(-glm::vec3(headPose[2]));
+
+        // Everyone is of full interest, we just keep the version the player has if the
+        // budget runs out
+        std::vector<EntitySelection<rpcmsg::PlayerData>> otherPlayers;
+        for (auto otherPlayer = gameData.playerData.begin(); otherPlayer != gameData.playerData.end(); otherPlayer++) {
+            if (otherPlayer->first == playerID)
+                continue;
+            const rpcmsg::PlayerData * baselineCopy = nullptr;
+            if (baselineView != nullptr) {
+                auto baselinePlayer = baselineView->playerData.find(otherPlayer->first);
+                if (baselinePlayer != baselineView->playerData.end())
+                    baselineCopy = &baselinePlayer->second;
+            }
+            otherPlayers.push_back({ otherPlayer->first, 0.0f, PRIORITY_OTHER_PLAYER, &otherPlayer->second, baselineCopy, true });
+        }
+
+        // Only the closest castle crashers make it in if there are too many of them
+        auto castleCrashers = selectEntities(gameData.gameState.castleCrasherData,
+            baselineView ? &baselineView->gameState.castleCrasherData : nullptr,
+            headPosition, headForward, tick, baselineTick, &getCastleCrasherPosition,
+            PRIORITY_NEAR_CASTLE_CRASHER, PRIORITY_FAR_CASTLE_CRASHER);
+        if (castleCrashers.size() > INTEREST_MAX_CASTLE_CRASHERS) {
+            std::nth_element(castleCrashers.begin(), castleCrashers.begin() + INTEREST_MAX_CASTLE_CRASHERS, castleCrashers.end(),
+                [](const EntitySelection<rpcmsg::CastleCrasherData> & a,
+                    const EntitySelection<rpcmsg::CastleCrasherData> & b) { return a.distance < b.distance; });
+            castleCrashers.resize(INTEREST_MAX_CASTLE_CRASHERS);
+        }
+
+        auto flyingArrows = selectEntities<rpcmsg::ArrowData>(gameData.gameState.flyingArrows,
+            baselineView ? &baselineView->gameState.flyingArrows : nullptr,
+            headPosition, headForward, tick, baselineTick, nullptr, PRIORITY_FLYING_ARROW, PRIORITY_FLYING_ARROW);
+
+        auto multiplierDisplays = selectEntities(gameData.gameState.multiplierDisplayData,
+            baselineView ? &baselineView->gameState.multiplierDisplayData : nullptr,
+            headPosition, headForward, tick, baselineTick, &getMultiplierDisplayPosition,
+            PRIORITY_MULTIPLIER_DISPLAY, PRIORITY_MULTIPLIER_DISPLAY);
+
+        // Fill the budget with the most important changes first. What the player's own data
+        // and the game state take comes off the top
+        if (byteBudget > 0) {
+            std::unordered_map<uint64_t, uint64_t> lastRefreshedTicks;
+            this->playerViewsLock.lock();
+            lastRefreshedTicks.swap(this->playerViews[playerID].refreshedTicks);
+            this->playerViewsLock.unlock();
+
+            RPCLIB_MSGPACK::sbuffer scratch;
+            const rpcmsg::PlayerData * baselineSelf = nullptr;
+            if (baselineView != nullptr) {
+                auto baselinePlayer = baselineView->playerData.find(playerID);
+                if (baselinePlayer != baselineView->playerData.end())
+                    baselineSelf = &baselinePlayer->second;
+            }
+            size_t fixedCost = measureDelta(playerID, baselineSelf, player->second, scratch) +
+                measureDelta((uint32_t)0, baselineView ? &baselineView->gameState : nullptr, gameData.gameState, scratch);
+            size_t remainingBudget = (fixedCost < byteBudget) ? (byteBudget - fixedCost) : 0;
+
+            std::vector<BudgetCandidate> candidates;
+            addBudgetCandidates(otherPlayers, CATEGORY_PLAYER, tick, lastRefreshedTicks, refreshedTicks, candidates, scratch);
+            addBudgetCandidates(castleCrashers, CATEGORY_CASTLE_CRASHER, tick, lastRefreshedTicks, refreshedTicks, candidates, scratch);
+            addBudgetCandidates(flyingArrows, CATEGORY_FLYING_ARROW, tick, lastRefreshedTicks, refreshedTicks, candidates, scratch);
+            addBudgetCandidates(multiplierDisplays, CATEGORY_MULTIPLIER_DISPLAY, tick, lastRefreshedTicks, refreshedTicks, candidates, scratch);
+
+            std::sort(candidates.begin(), candidates.end(),
+                [](const BudgetCandidate & a, const BudgetCandidate & b) { return a.priority > b.priority; });
+            for (auto candidate = candidates.begin(); candidate != candidates.end(); candidate++) {
+                if (candidate->cost > remainingBudget)
+                    continue;
+                remainingBudget -= candidate->cost;
+                *candidate->refresh = true;
+                refreshedTicks[candidate->key] = tick;
+            }
+        }
+
+        view->playerData[playerID] = player->second;
+        for (auto otherPlayer = otherPlayers.begin(); otherPlayer != otherPlayers.end(); otherPlayer++) {
+            const rpcmsg::PlayerData * playerData = otherPlayer->refresh ? otherPlayer->current : otherPlayer->baseline;
+            if (playerData != nullptr)
+                view->playerData[otherPlayer->entityID] = *playerData;
+        }
+        addSelectedEntities(castleCrashers, view->gameState.castleCrasherData);
+        addSelectedEntities(flyingArrows, view->gameState.flyingArrows);
+        addSelectedEntities(multiplierDisplays, view->gameState.multiplierDisplayData);
+    }
+
+    // Remember what we sent so the next delta can be made against it
+    std::lock_guard<std::mutex> playerViewsGuard(this->playerViewsLock);
+    PlayerViews & playerViews = this->playerViews[playerID];
+    if (playerViews.views.empty()) {
+        playerViews.ticks.resize(INTEREST_VIEW_HISTORY_SIZE, 0);
+        playerViews.views.resize(INTEREST_VIEW_HISTORY_SIZE);
+    }
+    playerViews.ticks[tick % INTEREST_VIEW_HISTORY_SIZE] = tick;
+    playerViews.views[tick % INTEREST_VIEW_HISTORY_SIZE] = view;
+    if (byteBudget > 0)
+        playerViews.refreshedTicks.swap(refreshedTicks);
+    return view;
+}
+
+void InterestManager::removePlayer(uint32_t playerID)
+{
+    std::lock_guard<std::mutex> playerViewsGuard(this->playerViewsLock);
+    this->playerViews.erase(playerID);
+}
@@ -0,0 +1,85 @@
+#include "NeighborhoodGrid.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+NeighborhoodGrid::NeighborhoodGrid(const glm::vec2 & minCorner, const glm::vec2 & maxCorner, float cellSize)
+{
+    this->minCorner = minCorner;
+    this->cellSize = cellSize;
+    this->columns = std::max(1, (int)std::ceil((maxCorner.x - minCorner.x) / cellSize));
+    this->rows = std::max(1, (int)std::ceil((maxCorner.y - minCorner.y) / cellSize));
+    this->cellStart.assign(this->columns * this->rows + 1, 0);
+}
+
+// Entities outside of the grid are clamped to the border cells
+int NeighborhoodGrid::getColumn(float x) const
+{
+    int column = (int)std::floor((x - this->minCorner.x) / this->cellSize);
+    return std::min(std::max(column, 0), this->columns - 1);
+}
+
+int NeighborhoodGrid::getRow(float z) const
+{
+    int row = (int)std::floor((z - this->minCorner.y) / this->cellSize);
+    return std::min(std::max(row, 0), this->rows - 1);
+}
+
+void NeighborhoodGrid::build(const std::vector<glm::vec3> & positions)
+{
+    std::fill(this->cellStart.begin(), this->cellStart.end(), 0);
+
+    // Count the entities in each cell
+    this->entityCell.resize(positions.size());
+    for (uint32_t entity = 0; entity < positions.size(); entity++) {
+        this->entityCell[entity] = this->getRow(positions[entity].z) * this->columns + this->getColumn(positions[entity].x);
+        this->cellStart[this->entityCell[entity] + 1]++;
+    }
+
+    // Turn the counts into offsets, then scatter the entities into place
+    for (size_t cell = 1; cell < this->cellStart.size(); cell++)
+        this->cellStart[cell] += this->cellStart[cell - 1];
+    std::vector<uint32_t> insertPosition(this->cellStart.begin(), this->cellStart.end() - 1);
+    this->sortedEntities.resize(positions.size());
+    this->sortedPositions.resize(positions.size());
+    for (uint32_t entity = 0; entity < positions.size(); entity++) {
+        uint32_t index = insertPosition[this->entityCell[entity]]++;
+        this->sortedEntities[index] = entity;
+        this->sortedPositions[index] = glm::vec2(positions[entity].x, positions[entity].z);
+    }
+}
+
+void NeighborhoodGrid::findNeighbors(const glm::vec3 & position, float radius, std::vector<uint32_t> & neighbors) const
+{
+    neighbors.clear();
+    int column = this->getColumn(position.x);
+    int row = this->getRow(position.z);
+    glm::vec2 center = glm::vec2(position.x, position.z);
+    float radiusSquared = radius * radius;
+
+    // Only the surrounding 3x3 cells can hold entities within one cell size. The cells of a
+    // row are stored next to each other, so each row is a single run of entities
+    int firstColumn = std::max(column - 1, 0);
+    int lastColumn = std::min(column + 1, this->columns - 1);
+    int firstRow = std::max(row - 1, 0);
+    int lastRow = std::min(row + 1, this->rows - 1);
+    size_t candidates = 0;
+    for (int neighborRow = firstRow; neighborRow <= lastRow; neighborRow++)
+        candidates += this->cellStart[neighborRow * this->columns + lastColumn + 1] -
+            this->cellStart[neighborRow * this->columns + firstColumn];
+
+    // Every candidate is written and only kept if it is in range. Whether it is in range
+    // is close to random, so this is much cheaper than branching on it
+    neighbors.resize(candidates);
+    size_t count = 0;
+    for (int neighborRow = firstRow; neighborRow <= lastRow; neighborRow++) {
+        uint32_t first = this->cellStart[neighborRow * this->columns + firstColumn];
+        uint32_t last = this->cellStart[neighborRow * this->columns + lastColumn + 1];
+        for (uint32_t index = first; index < last; index++) {
+            glm::vec2 offset = this->sortedPositions[index] - center;
+            neighbors[count] = this->sortedEntities[index];
+            count += (offset.x * offset.x + offset.y * offset.y < radiusSquared) ? 1 : 0;
+        }
+    }
+    neighbors.resize(count);
+}
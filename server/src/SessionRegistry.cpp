@@ -0,0 +1,180 @@
+#include "SessionRegistry.hpp"
+
+// Left in a slot whose session was removed, so lookups keep probing past it
+static SessionRegistry::Session removedSession;
+static SessionRegistry::Session * const REMOVED_SESSION = &removedSession;
+
+// Slot the player's probe sequence starts at. The low bits of the ID already picked the shard
+static size_t getFirstSlot(uint32_t playerID)
+{
+    return (playerID / SESSION_REGISTRY_SHARDS) % SESSION_REGISTRY_SHARD_CAPACITY;
+}
+
+SessionRegistry::SessionRegistry()
+{
+    for (int shard = 0; shard < SESSION_REGISTRY_SHARDS; shard++) {
+        for (int slot = 0; slot < SESSION_REGISTRY_SHARD_CAPACITY; slot++)
+            this->shards[shard].slots[slot] = nullptr;
+    }
+    this->sessionCount = 0;
+}
+
+SessionRegistry::~SessionRegistry()
+{
+    for (int shard = 0; shard < SESSION_REGISTRY_SHARDS; shard++) {
+        for (int slot = 0; slot < SESSION_REGISTRY_SHARD_CAPACITY; slot++) {
+            Session * session = this->shards[shard].slots[slot].load();
+            if ((session != nullptr) && (session != REMOVED_SESSION))
+                delete session;
+        }
+    }
+    for (auto session = this->retiredSessions.begin(); session != this->retiredSessions.end(); session++)
+        delete *session;
+    for (auto session = this->reclaimableSessions.begin(); session != this->reclaimableSessions.end(); session++)
+        delete *session;
+}
+
+SessionRegistry::Shard & SessionRegistry::getShard(uint32_t playerID)
+{
+    return this->shards[playerID % SESSION_REGISTRY_SHARDS];
+}
+
+const SessionRegistry::Shard & SessionRegistry::getShard(uint32_t playerID) const
+{
+    return this->shards[playerID % SESSION_REGISTRY_SHARDS];
+}
+
+// Probe from the player's first slot until their session or a slot that was never used
+// turns up. Only atomic loads, so any number of threads can look up sessions at once
+SessionRegistry::Session * SessionRegistry::find(uint32_t playerID) const
+{
+    const Shard & shard = this->getShard(playerID);
+    size_t firstSlot = getFirstSlot(playerID);
+    for (size_t probe = 0; probe < SESSION_REGISTRY_SHARD_CAPACITY; probe++) {
+        Session * session = shard.slots[(firstSlot + probe) % SESSION_REGISTRY_SHARD_CAPACITY].load(std::memory_order_acquire);
+        if (session == nullptr)
+            return nullptr;
+        if ((session != REMOVED_SESSION) && (session->playerID == playerID))
+            return session;
+    }
+    return nullptr;
+}
+
+bool SessionRegistry::add(uint32_t playerID, uint64_t sessionToken, std::chrono::nanoseconds currentTime)
+{
+    Shard & shard = this->getShard(playerID);
+    std::lock_guard<std::mutex> lock(shard.writeLock);
+
+    // Make sure the player isn't in the table yet, and remember the first slot free to take
+    size_t firstSlot = getFirstSlot(playerID);
+    std::atomic<Session *> * freeSlot = nullptr;
+    for (size_t probe = 0; probe < SESSION_REGISTRY_SHARD_CAPACITY; probe++) {
+        std::atomic<Session *> & slot = shard.slots[(firstSlot + probe) % SESSION_REGISTRY_SHARD_CAPACITY];
+        Session * session = slot.load(std::memory_order_relaxed);
+        if ((session == nullptr) || (session == REMOVED_SESSION)) {
+            if (freeSlot == nullptr)
+                freeSlot = &slot;
+            if (session == nullptr)
+                break;
+        }
+        else if (session->playerID == playerID)
+            return false;
+    }
+    if (freeSlot == nullptr)
+        return false;
+
+    Session * session = new Session();
+    session->playerID = playerID;
+    session->sessionToken = sessionToken;
+    session->lastCommunicated = currentTime.count();
+    session->snapshotTickInterval = 0;
+
+    // Readers see the session only once it is filled in
+    freeSlot->store(session, std::memory_order_release);
+    this->sessionCount++;
+    return true;
+}
+
+bool SessionRegistry::remove(uint32_t playerID)
+{
+    Shard & shard = this->getShard(playerID);
+    std::lock_guard<std::mutex> lock(shard.writeLock);
+
+    size_t firstSlot = getFirstSlot(playerID);
+    for (size_t probe = 0; probe < SESSION_REGISTRY_SHARD_CAPACITY; probe++) {
+        std::atomic<Session *> & slot = shard.slots[(firstSlot + probe) % SESSION_REGISTRY_SHARD_CAPACITY];
+        Session * session = slot.load(std::memory_order_relaxed);
+        if (session == nullptr)
+            return false;
+        if ((session != REMOVED_SESSION) && (session->playerID == playerID)) {
+
+            // Readers that already picked up the session keep using it until they are done
+            slot.store(REMOVED_SESSION, std::memory_order_release);
+            this->sessionCount--;
+            std::lock_guard<std::mutex> retiredLock(this->retiredSessionsLock);
+            this->retiredSessions.push_back(session);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Readers never hold on to a session past the call that looked it up. By the time a session
+// has sat out a whole period between two calls, nobody can still be reading it
+void SessionRegistry::reclaimRetiredSessions()
+{
+    std::lock_guard<std::mutex> retiredLock(this->retiredSessionsLock);
+    for (auto session = this->reclaimableSessions.begin(); session != this->reclaimableSessions.end(); session++)
+        delete *session;
+    this->reclaimableSessions.swap(this->retiredSessions);
+    this->retiredSessions.clear();
+}
+
+bool SessionRegistry::contains(uint32_t playerID) const
+{
+    return this->find(playerID) != nullptr;
+}
+
+bool SessionRegistry::authenticate(uint32_t playerID, uint64_t sessionToken) const
+{
+    Session * session = this->find(playerID);
+    return (session != nullptr) && (session->sessionToken == sessionToken);
+}
+
+bool SessionRegistry::touch(uint32_t playerID, std::chrono::nanoseconds currentTime)
+{
+    Session * session = this->find(playerID);
+    if (session == nullptr)
+        return false;
+    session->lastCommunicated.store(currentTime.count(), std::memory_order_relaxed);
+    return true;
+}
+
+bool SessionRegistry::getLastCommunicated(uint32_t playerID, std::chrono::nanoseconds & lastCommunicated) const
+{
+    Session * session = this->find(playerID);
+    if (session == nullptr)
+        return false;
+    lastCommunicated = std::chrono::nanoseconds(session->lastCommunicated.load(std::memory_order_relaxed));
+    return true;
+}
+
+bool SessionRegistry::setSnapshotTickInterval(uint32_t playerID, uint32_t snapshotTickInterval)
+{
+    Session * session = this->find(playerID);
+    if (session == nullptr)
+        return false;
+    session->snapshotTickInterval = snapshotTickInterval;
+    return true;
+}
+
+uint32_t SessionRegistry::getSnapshotTickInterval(uint32_t playerID) const
+{
+    Session * session = this->find(playerID);
+    return (session != nullptr) ? session->snapshotTickInterval.load() : 0;
+}
+
+size_t SessionRegistry::size() const
+{
+    return this->sessionCount;
+}
@@ -0,0 +1,69 @@
+#include "SnapshotOutbox.hpp"
+
+SnapshotOutbox::SnapshotOutbox(size_t maxControlMessages)
+{
+    this->pendingTick = 0;
+    this->maxControlMessages = maxControlMessages;
+    this->overwrittenSnapshots = 0;
+    this->closed = false;
+}
+
+void SnapshotOutbox::offerSnapshot(std::shared_ptr<const rpcmsg::GameData> gameData, uint64_t tick)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+    if (this->closed)
+        return;
+    if (this->pendingGameData != nullptr)
+        this->overwrittenSnapshots++;
+    this->pendingGameData = std::move(gameData);
+    this->pendingTick = tick;
+    this->messageReady.notify_one();
+}
+
+bool SnapshotOutbox::queueControlMessage(std::vector<char> message)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+    if (this->closed || (this->controlMessages.size() >= this->maxControlMessages))
+        return false;
+    this->controlMessages.push_back(std::move(message));
+    this->messageReady.notify_one();
+    return true;
+}
+
+bool SnapshotOutbox::waitForMessage(Message & message)
+{
+    std::unique_lock<std::mutex> lock(this->lock);
+    this->messageReady.wait(lock, [this]() {
+        return this->closed || (!this->controlMessages.empty()) || (this->pendingGameData != nullptr);
+    });
+
+    // Control messages still go out after closing, a snapshot no longer matters by then
+    if (!this->controlMessages.empty()) {
+        message.isControl = true;
+        message.control = std::move(this->controlMessages.front());
+        this->controlMessages.pop_front();
+        return true;
+    }
+    if (this->closed)
+        return false;
+
+    message.isControl = false;
+    message.gameData = std::move(this->pendingGameData);
+    message.tick = this->pendingTick;
+    this->pendingGameData = nullptr;
+    return true;
+}
+
+uint64_t SnapshotOutbox::getOverwrittenSnapshots()
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+    return this->overwrittenSnapshots;
+}
+
+void SnapshotOutbox::close()
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+    this->closed = true;
+    this->pendingGameData = nullptr;
+    this->messageReady.notify_all();
+}
@@ -0,0 +1,81 @@
+#include "TimingWheel.hpp"
+
+TimingWheel::TimingWheel(uint64_t startTick)
+{
+    this->slots.resize(LEVELS * SLOTS_PER_LEVEL);
+    this->currentTick = startTick;
+    this->pendingEvents = 0;
+}
+
+// Place the event on the finest level whose range still covers its due tick
+void TimingWheel::insert(const Event & event)
+{
+    uint64_t ticksLeft = event.dueTick - this->currentTick;
+    int level = 0;
+    while ((level < LEVELS - 1) && (ticksLeft >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))))
+        level++;
+
+    // Events too far out for the top level wait there and get re-inserted on each pass
+    uint64_t slot = (event.dueTick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+    this->slots[level * SLOTS_PER_LEVEL + slot].push_back(event);
+}
+
+// Redistribute the current slot of a coarser level over the finer levels
+void TimingWheel::cascade(int level)
+{
+    uint64_t slot = (this->currentTick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+    std::vector<Event> events;
+    events.swap(this->slots[level * SLOTS_PER_LEVEL + slot]);
+    for (auto event = events.begin(); event != events.end(); event++)
+        this->insert(*event);
+}
+
+void TimingWheel::schedule(uint64_t dueTick, uint32_t type, uint32_t entityID)
+{
+    Event event;
+    event.dueTick = (dueTick > this->currentTick) ? dueTick : this->currentTick + 1;
+    event.type = type;
+    event.entityID = entityID;
+    this->insert(event);
+    this->pendingEvents++;
+}
+
+void TimingWheel::advance(uint64_t tick, std::vector<Event> & dueEvents)
+{
+    while (this->currentTick < tick) {
+        this->currentTick++;
+
+        // Whenever a level wraps around, pull the next slot of the level above down.
+        // Higher levels go first so their events can land in the levels below
+        int wrappedLevels = 0;
+        while ((wrappedLevels < LEVELS - 1) &&
+            (((this->currentTick >> (SLOT_BITS * wrappedLevels)) & (SLOTS_PER_LEVEL - 1)) == 0))
+            wrappedLevels++;
+        for (int level = wrappedLevels; level > 0; level--)
+            this->cascade(level);
+
+        // Everything left in the finest slot is due now
+        std::vector<Event> slot;
+        slot.swap(this->slots[this->currentTick & (SLOTS_PER_LEVEL - 1)]);
+        for (auto event = slot.begin(); event != slot.end(); event++) {
+            if (event->dueTick <= this->currentTick) {
+                dueEvents.push_back(*event);
+                this->pendingEvents--;
+            }
+            else
+                this->insert(*event);
+        }
+    }
+}
+
+void TimingWheel::clear()
+{
+    for (auto slot = this->slots.begin(); slot != this->slots.end(); slot++)
+        slot->clear();
+    this->pendingEvents = 0;
+}
+
+size_t TimingWheel::size() const
+{
+    return this->pendingEvents;
+}
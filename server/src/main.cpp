@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 
 #include "GameServer.hpp"
 
@@ -15,8 +16,14 @@ int main() {
         return -1;
     }
 
+    // Horde mode spawns thousands of castle crashers instead of a handful
+    std::string hordeModeAnswer;
+    std::cout << "Enable horde mode? [y/N]: ";
+    std::getline(std::cin, hordeModeAnswer);
+    bool hordeMode = (hordeModeAnswer == "y") || (hordeModeAnswer == "Y");
+
     // Start the game server
-    GameServer gameServer(portNumber);
+    GameServer gameServer(portNumber, hordeMode);
 
     // Wait for user to decide to stop the program
     std::cout << "\tPress [ENTER] anytime to stop the server" << std::endl;
@@ -0,0 +1,64 @@
+#ifndef __DATAGRAM_SOCKET__
+#define __DATAGRAM_SOCKET__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <cstdint>
+
+#include "SocketStream.hpp"
+
+#define MAX_DATAGRAM_SIZE           65507
+#define DATAGRAM_RECEIVE_TIMEOUT_MS 100
+
+// IPv4 address and port of the other end of a datagram, in network byte order
+struct DatagramEndpoint {
+    uint32_t address;
+    uint16_t port;
+
+    bool operator==(const DatagramEndpoint & other) const {
+        return (this->address == other.address) && (this->port == other.port);
+    }
+    bool operator!=(const DatagramEndpoint & other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Unconnected UDP socket for traffic where only the newest message matters. Datagrams
+ * may be lost, duplicated or reordered, so whatever goes over it has to carry its own
+ * sequence number. Outgoing datagrams can be dropped on purpose to try out lossy links.
+ */
+class DatagramSocket
+{
+private:
+
+    std::atomic<SocketHandle> socketHandle;
+
+    // Simulated loss of outgoing datagrams
+    std::atomic<float> lossProbability;
+    std::mt19937 lossGenerator;
+    std::mutex lossGeneratorLock;
+
+public:
+
+    DatagramSocket();
+    ~DatagramSocket();
+
+    // Port 0 lets the system pick one
+    bool open(int portNumber);
+    static bool resolve(const std::string & ipAddress, int portNumber, DatagramEndpoint & endpoint);
+
+    bool sendTo(const DatagramEndpoint & endpoint, const char * data, size_t size);
+
+    // Waits up to DATAGRAM_RECEIVE_TIMEOUT_MS. Returns false if nothing came in or the socket is closed
+    bool receiveFrom(std::vector<char> & datagram, DatagramEndpoint & endpoint);
+
+    void setSimulatedLoss(float lossProbability);
+    bool isOpen() const;
+    void close();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __SHARED_MEMORY_RING__
+#define __SHARED_MEMORY_RING__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#define SHARED_MEMORY_NAME_PREFIX   "TowerDefender_"
+#define SHARED_SNAPSHOT_SLOT_COUNT  8
+#define SHARED_SNAPSHOT_SLOT_SIZE   (1024 * 1024)
+#define SHARED_INPUT_SLOT_COUNT     256
+#define SHARED_INPUT_SLOT_SIZE      1024
+
+/**
+ * Named block of memory shared between processes on the same host. Whoever creates it
+ * owns the name and removes it again when closing.
+ */
+class SharedMemoryRegion
+{
+private:
+
+    std::string name;
+    void * address;
+    size_t regionSize;
+    bool owner;
+#ifdef _WIN32
+    void * mappingHandle;
+#endif
+
+public:
+
+    SharedMemoryRegion();
+    ~SharedMemoryRegion();
+
+    bool create(const std::string & name, size_t size);
+    bool open(const std::string & name);
+    void * data() const;
+    size_t size() const;
+    void close();
+};
+
+/**
+ * Single writer, many reader ring of the most recent snapshots. Readers look at a slot in
+ * place and check afterwards that the writer didn't come around and overwrite it while
+ * they were reading (a sequence lock), so nothing is copied out of shared memory first.
+ * Readers sign in and out in the ring's header so the writer can tell when nobody is
+ * reading and skip publishing altogether.
+ */
+class SnapshotRing
+{
+private:
+
+    struct Header;
+    struct Slot;
+
+    SharedMemoryRegion region;
+    Header * header;
+    uint64_t lastReadSequence;
+    bool reader;
+
+    Slot * getSlot(uint64_t sequence) const;
+
+public:
+
+    SnapshotRing();
+    ~SnapshotRing();
+
+    // Writer side
+    bool create(const std::string & name);
+    bool publish(const char * data, size_t size);
+
+    // Whether any reader has the ring open. A reader that dies without closing the ring
+    // keeps counting until the writer creates it again
+    bool hasReaders() const;
+
+    // Reader side. Hands the newest snapshot not read yet to the callback, right out of
+    // shared memory. Returns false if there was nothing new, or if the snapshot was
+    // overwritten while the callback looked at it and whatever it got must be thrown away.
+    // Whatever was published before the reader opened the ring is skipped, since the writer
+    // may have stopped publishing long before
+    bool open(const std::string & name);
+    bool readLatest(const std::function<void(const char *, size_t)> & consume);
+
+    void close();
+};
+
+/**
+ * Single producer, single consumer ring of small messages, used by a local client to
+ * hand its input to the server
+ */
+class InputRing
+{
+private:
+
+    struct Header;
+
+    SharedMemoryRegion region;
+    Header * header;
+
+    char * getSlot(uint64_t index) const;
+
+public:
+
+    InputRing();
+
+    bool create(const std::string & name);
+    bool open(const std::string & name);
+
+    // Producer side. Returns false if the ring is full or the message too big
+    bool push(const char * data, size_t size);
+
+    // Consumer side. Returns false if the ring is empty
+    bool pop(std::vector<char> & message);
+
+    void close();
+};
+
+// Names the server gives its rings, so local clients can find them
+std::string getSnapshotRingName(int portNumber);
+std::string getInputRingName(int portNumber, uint32_t playerID);
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef __SNAPSHOT_DELTA__
+#define __SNAPSHOT_DELTA__
+
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <cstdint>
+
+#include "rpcMessages.hpp"
+
+/**
+ * Delta encoding of GameData between two published ticks. Entities are matched by
+ * their stable ID (player ID or entityID) and only the fields that changed since the
+ * baseline go over the wire. A delta without a baseline carries every field of every
+ * entity and doubles as a full snapshot. Poses, positions, headings, health and opacity
+ * use the compact wire encodings from rpcMessages.hpp; the server keeps full precision,
+ * except for castle crasher headings which it keeps on the wire steps.
+ */
+namespace rpcmsg {
+
+    // Fields of each entity that can be sent on their own, in wire order (at most 32).
+    // The entity's ID is sent next to the field mask and is not part of this list
+#define DELTA_FIELDS(Type, ...) \
+    inline auto deltaFields(Type & d) { return std::tie(__VA_ARGS__); } \
+    inline auto deltaFields(const Type & d) { return std::tie(__VA_ARGS__); }
+
+    // How each of those fields is encoded on the wire, in the same order
+#define DELTA_ENCODINGS(Type, ...) \
+    inline std::tuple<__VA_ARGS__> deltaEncodings(const Type &) { return std::tuple<__VA_ARGS__>(); }
+
+    namespace wire {
+        struct Plain {};      // Regular msgpack
+        struct Nested {};     // Struct (or array of structs) using its own field encodings
+        struct Pose {};       // rpcmsg::QuantizedPose
+        struct Position {};   // rpcmsg::QuantizedPosition
+        struct Health {};     // Fixed point byte, WIRE_HEALTH_SCALE steps per point
+        struct Opacity {};    // Fixed point byte, WIRE_OPACITY_SCALE steps per unit
+        struct Heading {};    // Byte, WIRE_HEADING_STEPS steps per turn
+    }
+
+    DELTA_FIELDS(rpcmsg::HeadData, d.headPose)
+    DELTA_ENCODINGS(rpcmsg::HeadData, wire::Pose)
+    DELTA_FIELDS(rpcmsg::HandData, d.handPose, d.thumbstickValue, d.buttonState, d.indexTriggerValue, d.handTriggerValue)
+    DELTA_ENCODINGS(rpcmsg::HandData, wire::Pose, wire::Plain, wire::Plain, wire::Plain, wire::Plain)
+
+    DELTA_FIELDS(rpcmsg::PlayerData, d.headData, d.handData, d.arrowData, d.dominantHand,
+        d.arrowFiringAudioCue, d.arrowStretchingAudioCue, d.arrowReleased, d.arrowReadying,
+        d.viewTimeMilliseconds, d.sampleTimeMicroseconds, d.inputSequence)
+    DELTA_ENCODINGS(rpcmsg::PlayerData, wire::Nested, wire::Nested, wire::Nested, wire::Plain,
+        wire::Plain, wire::Plain, wire::Plain, wire::Plain, wire::Plain, wire::Plain, wire::Plain)
+    DELTA_FIELDS(rpcmsg::CastleCrasherData, d.id, d.alive, d.health, d.animationCycle, d.direction,
+        d.position, d.endPosition, d.nextDirectionChangeTimeMilliseconds, d.lastAttackTimeMilliseconds)
+    DELTA_ENCODINGS(rpcmsg::CastleCrasherData, wire::Plain, wire::Plain, wire::Health, wire::Plain,
+        wire::Heading, wire::Position, wire::Position, wire::Plain, wire::Plain)
+    DELTA_FIELDS(rpcmsg::ArrowData, d.arrowPose, d.arrowType, d.launchTimeMilliseconds,
+        d.lagCompensationMilliseconds, d.initVelocity, d.initPosition, d.position)
+    DELTA_ENCODINGS(rpcmsg::ArrowData, wire::Pose, wire::Plain, wire::Plain, wire::Plain,
+        wire::Plain, wire::Position, wire::Position)
+    DELTA_FIELDS(rpcmsg::MultiplierDisplayData, d.multiplier, d.pose, d.opacity)
+    DELTA_ENCODINGS(rpcmsg::MultiplierDisplayData, wire::Plain, wire::Pose, wire::Opacity)
+    DELTA_FIELDS(rpcmsg::GameState, d.gameStarted, d.gameScore, d.castleHealth, d.leftTowerReady,
+        d.rightTowerReady, d.enemyDiedCue, d.scoreMultiplier, d.serverTimeMilliseconds)
+    DELTA_ENCODINGS(rpcmsg::GameState, wire::Plain, wire::Plain, wire::Health, wire::Plain,
+        wire::Plain, wire::Plain, wire::Plain, wire::Plain)
+
+#undef DELTA_FIELDS
+#undef DELTA_ENCODINGS
+
+    // Field by field comparison used to find out what changed
+    inline bool operator==(const rpcmsg::vec2 & a, const rpcmsg::vec2 & b) {
+        return (a.x == b.x) && (a.y == b.y);
+    }
+    inline bool operator==(const rpcmsg::vec3 & a, const rpcmsg::vec3 & b) {
+        return (a.x == b.x) && (a.y == b.y) && (a.z == b.z);
+    }
+    inline bool operator==(const rpcmsg::HeadData & a, const rpcmsg::HeadData & b) {
+        return deltaFields(a) == deltaFields(b);
+    }
+    inline bool operator==(const rpcmsg::HandData & a, const rpcmsg::HandData & b) {
+        return deltaFields(a) == deltaFields(b);
+    }
+    inline bool operator==(const rpcmsg::ArrowData & a, const rpcmsg::ArrowData & b) {
+        return deltaFields(a) == deltaFields(b);
+    }
+
+    // Changed fields of one entity. Only the fields set in fieldMask hold meaningful data
+    template <typename T>
+    struct EntityDelta {
+        uint32_t entityID;
+        uint32_t fieldMask;
+        T        data;
+    };
+
+    // RPC message that holds everything that changed between two ticks
+    struct GameDataDelta {
+        uint64_t                                            tick;
+        uint64_t                                            baselineTick;   // 0 for a full snapshot
+        rpcmsg::EntityDelta<rpcmsg::GameState>              gameState;
+        std::vector<uint32_t>                               removedPlayers;
+        std::vector<rpcmsg::EntityDelta<rpcmsg::PlayerData>> changedPlayers;
+        std::vector<uint32_t>                               removedCastleCrashers;
+        std::vector<rpcmsg::EntityDelta<rpcmsg::CastleCrasherData>> changedCastleCrashers;
+        std::vector<uint32_t>                               removedFlyingArrows;
+        std::vector<rpcmsg::EntityDelta<rpcmsg::ArrowData>> changedFlyingArrows;
+        std::vector<uint32_t>                               removedMultiplierDisplays;
+        std::vector<rpcmsg::EntityDelta<rpcmsg::MultiplierDisplayData>> changedMultiplierDisplays;
+        MSGPACK_DEFINE_ARRAY(tick, baselineTick, gameState, removedPlayers, changedPlayers,
+            removedCastleCrashers, changedCastleCrashers, removedFlyingArrows, changedFlyingArrows,
+            removedMultiplierDisplays, changedMultiplierDisplays);
+    };
+
+    // Describe how to get from the baseline to the current game data. Pass a null
+    // baseline to get a full snapshot
+    rpcmsg::GameDataDelta makeGameDataDelta(const rpcmsg::GameData * baseline, uint64_t baselineTick,
+        const rpcmsg::GameData & current, uint64_t tick);
+
+    // Bring game data at the delta's baseline tick up to the delta's tick
+    void applyGameDataDelta(const rpcmsg::GameDataDelta & delta, rpcmsg::GameData & gameData);
+
+    // Mask with a bit set for each field that differs between the two entities
+    template <typename Tuple, size_t... Index>
+    uint32_t diffFields(const Tuple & baseline, const Tuple & current, std::index_sequence<Index...>) {
+        uint32_t fieldMask = 0;
+        int expand[] = { 0, ((fieldMask |= (std::get<Index>(baseline) == std::get<Index>(current)) ? 0u : (1u << Index)), 0)... };
+        (void)expand;
+        return fieldMask;
+    }
+
+    template <typename T>
+    uint32_t diffFields(const T & baseline, const T & current) {
+        return diffFields(deltaFields(baseline), deltaFields(current),
+            std::make_index_sequence<std::tuple_size<decltype(deltaFields(current))>::value>());
+    }
+
+    // Mask with every field of the entity set
+    template <typename T>
+    uint32_t allFields() {
+        return (uint32_t)((1ull << std::tuple_size<decltype(deltaFields(std::declval<const T &>()))>::value) - 1);
+    }
+
+    // Copy the fields set in the mask from one entity over to another
+    template <typename SourceTuple, typename TargetTuple, size_t... Index>
+    void copyFields(uint32_t fieldMask, const SourceTuple & source, TargetTuple target, std::index_sequence<Index...>) {
+        int expand[] = { 0, ((fieldMask & (1u << Index)) ? (std::get<Index>(target) = std::get<Index>(source), 0) : 0)... };
+        (void)expand;
+    }
+
+    template <typename T>
+    void copyFields(uint32_t fieldMask, const T & source, T & target) {
+        copyFields(fieldMask, deltaFields(source), deltaFields(target),
+            std::make_index_sequence<std::tuple_size<decltype(deltaFields(source))>::value>());
+    }
+
+    // Write a single field using its wire encoding
+    template <typename Stream, typename T>
+    void packField(clmdep_msgpack::packer<Stream> & o, const T & v, wire::Plain) {
+        o.pack(v);
+    }
+
+    template <typename Stream>
+    void packField(clmdep_msgpack::packer<Stream> & o, const rpcmsg::mat4 & v, wire::Pose) {
+        o.pack(rpcmsg::quantizePose(v));
+    }
+
+    template <typename Stream>
+    void packField(clmdep_msgpack::packer<Stream> & o, const rpcmsg::vec3 & v, wire::Position) {
+        o.pack(rpcmsg::quantizePosition(v));
+    }
+
+    template <typename Stream>
+    void packField(clmdep_msgpack::packer<Stream> & o, float v, wire::Health) {
+        o.pack(rpcmsg::quantizeFixedPoint(v, WIRE_HEALTH_SCALE));
+    }
+
+    template <typename Stream>
+    void packField(clmdep_msgpack::packer<Stream> & o, float v, wire::Opacity) {
+        o.pack(rpcmsg::quantizeFixedPoint(v, WIRE_OPACITY_SCALE));
+    }
+
+    template <typename Stream>
+    void packField(clmdep_msgpack::packer<Stream> & o, const rpcmsg::vec3 & v, wire::Heading) {
+        o.pack(rpcmsg::quantizeHeading(v));
+    }
+
+    template <typename Stream, typename Tuple, typename Encodings, size_t... Index>
+    void packFields(clmdep_msgpack::packer<Stream> & o, uint32_t fieldMask, const Tuple & fields,
+        const Encodings & encodings, std::index_sequence<Index...>) {
+        int expand[] = { 0, ((fieldMask & (1u << Index)) ?
+            (packField(o, std::get<Index>(fields), std::get<Index>(encodings)), 0) : 0)... };
+        (void)expand;
+    }
+
+    template <typename Stream, typename T>
+    void packField(clmdep_msgpack::packer<Stream> & o, const T & v, wire::Nested) {
+        auto fields = deltaFields(v);
+        const size_t fieldCount = std::tuple_size<decltype(fields)>::value;
+        o.pack_array(fieldCount);
+        packFields(o, allFields<T>(), fields, deltaEncodings(v), std::make_index_sequence<fieldCount>());
+    }
+
+    template <typename Stream, typename T, size_t Size>
+    void packField(clmdep_msgpack::packer<Stream> & o, const std::array<T, Size> & v, wire::Nested) {
+        o.pack_array(Size);
+        for (auto element = v.begin(); element != v.end(); element++)
+            packField(o, *element, wire::Nested());
+    }
+
+    // Read a single field back from its wire encoding
+    template <typename T>
+    void convertField(const clmdep_msgpack::object & o, T & v, wire::Plain) {
+        o.convert(v);
+    }
+
+    inline void convertField(const clmdep_msgpack::object & o, rpcmsg::mat4 & v, wire::Pose) {
+        rpcmsg::QuantizedPose pose;
+        o.convert(pose);
+        v = rpcmsg::dequantizePose(pose);
+    }
+
+    inline void convertField(const clmdep_msgpack::object & o, rpcmsg::vec3 & v, wire::Position) {
+        rpcmsg::QuantizedPosition position;
+        o.convert(position);
+        v = rpcmsg::dequantizePosition(position);
+    }
+
+    inline void convertField(const clmdep_msgpack::object & o, float & v, wire::Health) {
+        v = rpcmsg::dequantizeFixedPoint(o.as<uint8_t>(), WIRE_HEALTH_SCALE);
+    }
+
+    inline void convertField(const clmdep_msgpack::object & o, float & v, wire::Opacity) {
+        v = rpcmsg::dequantizeFixedPoint(o.as<uint8_t>(), WIRE_OPACITY_SCALE);
+    }
+
+    inline void convertField(const clmdep_msgpack::object & o, rpcmsg::vec3 & v, wire::Heading) {
+        v = rpcmsg::dequantizeHeading(o.as<uint8_t>());
+    }
+
+    // Fields set in the mask are read one after the other starting at next
+    template <typename Tuple, typename Encodings, size_t... Index>
+    void convertFields(const clmdep_msgpack::object * next, uint32_t fieldMask, Tuple fields,
+        const Encodings & encodings, std::index_sequence<Index...>) {
+        int expand[] = { 0, ((fieldMask & (1u << Index)) ?
+            (convertField(*(next++), std::get<Index>(fields), std::get<Index>(encodings)), 0) : 0)... };
+        (void)expand;
+    }
+
+    template <typename T>
+    void convertField(const clmdep_msgpack::object & o, T & v, wire::Nested) {
+        auto fields = deltaFields(v);
+        const size_t fieldCount = std::tuple_size<decltype(fields)>::value;
+        if ((o.type != clmdep_msgpack::type::ARRAY) || (o.via.array.size != fieldCount))
+            throw clmdep_msgpack::type_error();
+        convertFields(o.via.array.ptr, allFields<T>(), fields, deltaEncodings(v), std::make_index_sequence<fieldCount>());
+    }
+
+    template <typename T, size_t Size>
+    void convertField(const clmdep_msgpack::object & o, std::array<T, Size> & v, wire::Nested) {
+        if ((o.type != clmdep_msgpack::type::ARRAY) || (o.via.array.size != Size))
+            throw clmdep_msgpack::type_error();
+        for (size_t element = 0; element < Size; element++)
+            convertField(o.via.array.ptr[element], v[element], wire::Nested());
+    }
+}
+
+namespace clmdep_msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+    // An entity delta goes over the wire as [entityID, fieldMask, changed fields...]
+    template <typename T>
+    struct pack<rpcmsg::EntityDelta<T>> {
+        template <typename Stream>
+        clmdep_msgpack::packer<Stream> & operator()(clmdep_msgpack::packer<Stream> & o, const rpcmsg::EntityDelta<T> & v) const {
+            auto fields = rpcmsg::deltaFields(v.data);
+            uint32_t fieldCount = 0;
+            for (uint32_t fieldMask = v.fieldMask; fieldMask != 0; fieldMask &= fieldMask - 1)
+                fieldCount++;
+            o.pack_array(2 + fieldCount);
+            o.pack(v.entityID);
+            o.pack(v.fieldMask);
+            rpcmsg::packFields(o, v.fieldMask, fields, rpcmsg::deltaEncodings(v.data),
+                std::make_index_sequence<std::tuple_size<decltype(fields)>::value>());
+            return o;
+        }
+    };
+
+    template <typename T>
+    struct convert<rpcmsg::EntityDelta<T>> {
+        const clmdep_msgpack::object & operator()(const clmdep_msgpack::object & o, rpcmsg::EntityDelta<T> & v) const {
+            if ((o.type != clmdep_msgpack::type::ARRAY) || (o.via.array.size < 2))
+                throw clmdep_msgpack::type_error();
+            o.via.array.ptr[0].convert(v.entityID);
+            o.via.array.ptr[1].convert(v.fieldMask);
+
+            auto fields = rpcmsg::deltaFields(v.data);
+            uint32_t fieldCount = 0;
+            for (uint32_t fieldMask = v.fieldMask; fieldMask != 0; fieldMask &= fieldMask - 1)
+                fieldCount++;
+            if ((o.via.array.size != 2 + fieldCount) ||
+                ((v.fieldMask & ~rpcmsg::allFields<T>()) != 0))
+                throw clmdep_msgpack::type_error();
+            rpcmsg::convertFields(o.via.array.ptr + 2, v.fieldMask, fields, rpcmsg::deltaEncodings(v.data),
+                std::make_index_sequence<std::tuple_size<decltype(fields)>::value>());
+            return o;
+        }
+    };
+}
+}
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __SOCKET_STREAM__
+#define __SOCKET_STREAM__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+typedef SOCKET SocketHandle;
+#else
+typedef int SocketHandle;
+#endif
+
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+/**
+ * Bare TCP connection carrying length prefixed frames. Used for the streams rpclib
+ * can't do on its own, like the server pushing snapshots without being asked. Each
+ * frame is a 4 byte little endian length followed by that many bytes.
+ */
+class SocketStream
+{
+private:
+
+    std::atomic<SocketHandle> socketHandle;
+
+    bool sendAll(const char * data, size_t size);
+    bool receiveAll(char * data, size_t size);
+
+public:
+
+    SocketStream();
+    explicit SocketStream(SocketHandle socketHandle);
+    ~SocketStream();
+
+    bool connect(const std::string & ipAddress, int portNumber);
+    bool sendFrame(const char * data, size_t size);
+    bool receiveFrame(std::vector<char> & frame);
+    bool isOpen() const;
+
+    // Cap how much the kernel holds on to for us once the peer stops reading
+    void setSendBufferSize(int bytes);
+
+    // Safe to call from another thread to unblock a pending send or receive
+    void close();
+};
+
+/**
+ * Listens for incoming SocketStream connections on a port
+ */
+class SocketListener
+{
+private:
+
+    std::atomic<SocketHandle> socketHandle;
+
+public:
+
+    SocketListener();
+    ~SocketListener();
+
+    bool listen(int portNumber);
+
+    // Blocks until a client connects. Returns nullptr once the listener is closed, or if
+    // accepting this connection failed while the listener stays open
+    std::unique_ptr<SocketStream> accept();
+    bool isOpen() const;
+
+    // Safe to call from another thread to unblock a pending accept
+    void close();
+};
+
+#endif
@@ -2,7 +2,9 @@
 #define __RPC_MESSAGES__
 
 #include <vector>
+#include <memory>
 #include <cstdint>
+#include <string>
 
 #include "rpc/msgpack.hpp"
 
@@ -13,6 +15,25 @@
 #define LEFT_HAND  0
 #define RIGHT_HAND 1
 
+// Ranges of the compact encodings used in snapshots sent to clients
+#define WIRE_POSITION_MIN  -128.0f
+#define WIRE_POSITION_MAX   128.0f
+#define WIRE_HEALTH_SCALE   2.0f      // Half a health point per step
+#define WIRE_OPACITY_SCALE  127.0f    // Keeps opacity within a one byte msgpack fixint
+#define WIRE_HEADING_STEPS  128       // Steps around a full turn, keeps headings within a fixint
+
+// Time it takes a castle crasher to go through one walk cycle
+#define CASTLE_CRASHER_ANIMATION_MILLISECONDS 1000
+
+// Snapshots are pushed over their own stream on the port right after the RPC port
+#define SNAPSHOT_STREAM_PORT_OFFSET 1
+
+// The optional UDP channel uses the same port number as the RPC server
+#define DATAGRAM_PORT_OFFSET 0
+
+// Per-core RPC event loops listen on consecutive ports starting here
+#define RPC_LOOP_PORT_OFFSET 2
+
 /**
  * Custom RPC messages specificially made for the tower defender game. This includes
  * the user's Oculus poses and the current state of the game.
@@ -22,8 +43,46 @@ namespace rpcmsg {
     // Remote procedure function call name
     const std::string UPDATE_PLAYER_DATA = "UPDATE_PLAYER_DATA";
     const std::string GET_GAME_DATA = "GET_GAME_DATA";
+    const std::string GET_GAME_DATA_DELTA = "GET_GAME_DATA_DELTA";
+    const std::string GET_GAME_DATA_IF_NEWER = "GET_GAME_DATA_IF_NEWER";
+    const std::string OPEN_LOCAL_INPUT = "OPEN_LOCAL_INPUT";
+    const std::string GET_SESSION_LOOP_PORT = "GET_SESSION_LOOP_PORT";
     const std::string REQUEST_SERVER_SESSION = "REQUEST_SERVER_SESSION";
     const std::string CLOSE_SERVER_SESSION = "CLOSE_SERVER_SESSION";
+    const std::string NEGOTIATE_SNAPSHOT_RATE = "NEGOTIATE_SNAPSHOT_RATE";
+    const std::string GET_METHOD_IDS = "GET_METHOD_IDS";
+
+    // Numeric IDs for the calls above. Clients ask for the server's IDs when they connect and
+    // from then on call by the compact name made from the ID, which is short enough for the
+    // string to skip a heap allocation. The full names keep working for older clients
+    enum MethodID : uint32_t {
+        METHOD_UPDATE_PLAYER_DATA = 0,
+        METHOD_GET_GAME_DATA,
+        METHOD_GET_GAME_DATA_DELTA,
+        METHOD_GET_GAME_DATA_IF_NEWER,
+        METHOD_OPEN_LOCAL_INPUT,
+        METHOD_GET_SESSION_LOOP_PORT,
+        METHOD_REQUEST_SERVER_SESSION,
+        METHOD_CLOSE_SERVER_SESSION,
+        METHOD_NEGOTIATE_SNAPSHOT_RATE,
+        METHOD_COUNT
+    };
+
+    const std::string METHOD_NAMES[METHOD_COUNT] = {
+        UPDATE_PLAYER_DATA,
+        GET_GAME_DATA,
+        GET_GAME_DATA_DELTA,
+        GET_GAME_DATA_IF_NEWER,
+        OPEN_LOCAL_INPUT,
+        GET_SESSION_LOOP_PORT,
+        REQUEST_SERVER_SESSION,
+        CLOSE_SERVER_SESSION,
+        NEGOTIATE_SNAPSHOT_RATE
+    };
+
+    inline std::string getCompactMethodName(uint32_t methodID) {
+        return "#" + std::to_string(methodID);
+    }
 
     // ERROR messages
     const std::string INVALID_USER = "INVALID_USER_SPECIFIED";
@@ -68,13 +127,16 @@ namespace rpcmsg {
 
     // RPC message that holds data for user's arrow
     struct ArrowData {
+        uint32_t     entityID;
         rpcmsg::mat4 arrowPose;
         uint32_t     arrowType;
         uint64_t     launchTimeMilliseconds;
+        uint32_t     lagCompensationMilliseconds;
         rpcmsg::vec3 initVelocity;
         rpcmsg::vec3 initPosition;
         rpcmsg::vec3 position;
-        MSGPACK_DEFINE_ARRAY(arrowPose, arrowType, launchTimeMilliseconds, initVelocity, initPosition, position);
+        MSGPACK_DEFINE_ARRAY(entityID, arrowPose, arrowType, launchTimeMilliseconds, lagCompensationMilliseconds,
+            initVelocity, initPosition, position);
     };
 
     // RPC message that holds all the data relating to the user
@@ -87,31 +149,66 @@ namespace rpcmsg {
         uint32_t                        arrowStretchingAudioCue;
         bool                            arrowReleased;
         bool                            arrowReadying;
+        uint64_t                        viewTimeMilliseconds;   // Server time of the game state the user was seeing
+        uint64_t                        sampleTimeMicroseconds; // Client time the input was sampled at
+        uint32_t                        inputSequence;          // Latest input the server has taken in (0 at registration)
         MSGPACK_DEFINE_ARRAY(headData, handData, arrowData, dominantHand, 
-            arrowFiringAudioCue, arrowStretchingAudioCue, arrowReleased, arrowReadying);
+            arrowFiringAudioCue, arrowStretchingAudioCue, arrowReleased, arrowReadying,
+            viewTimeMilliseconds, sampleTimeMicroseconds, inputSequence);
+    };
+
+    // RPC message with one sample of the user's input. This is all the client sends about
+    // their player; everything else in PlayerData belongs to the server
+    struct InputFrame {
+        rpcmsg::mat4                headPose;
+        std::array<rpcmsg::mat4, 2> handPose;
+        std::array<rpcmsg::vec2, 2> thumbstickValue;
+        std::array<float, 2>        indexTriggerValue;
+        std::array<float, 2>        handTriggerValue;
+        uint32_t                    buttonState;            // Shared by both hands
+        uint64_t                    viewTimeMilliseconds;   // Server time of the game state the user was seeing
+        uint64_t                    sampleTimeMicroseconds; // Client time the input was sampled at
+        uint32_t                    inputSequence;          // Increases with every sample sent (0 at registration)
+        MSGPACK_DEFINE_ARRAY(headPose, handPose, thumbstickValue, indexTriggerValue, handTriggerValue,
+            buttonState, viewTimeMilliseconds, sampleTimeMicroseconds, inputSequence);
+    };
+
+    // What a client sends over the UDP channel. Recent input frames are repeated in every
+    // datagram so a lost one doesn't lose input, and the server answers with GameDataDelta
+    // datagrams made against the newest tick the client says it has
+    struct InputDatagram {
+        uint32_t                         playerID;
+        uint64_t                         acknowledgedTick;
+        uint32_t                         snapshotRate;
+        std::vector<rpcmsg::InputFrame>  inputFrames;
+        uint32_t                         snapshotByteBudget = 0;    // 0 for no limit
+        uint64_t                         sessionToken = 0;          // From SessionGrant
+        MSGPACK_DEFINE_ARRAY(playerID, acknowledgedTick, snapshotRate, inputFrames, snapshotByteBudget, sessionToken);
     };
 
     // RPC message that holds all data relating to a single castle crasher
     struct CastleCrasherData {
+        uint32_t     entityID;
         uint8_t      id;
         bool         alive;
         float        health;
-        float        animationCycle;
-        rpcmsg::vec3 direction;
+        float        animationCycle;    // Walk cycle in degrees at server time 0, see getAnimationCycle
+        rpcmsg::vec3 direction;         // Heading on the ground, in WIRE_HEADING_STEPS steps
         rpcmsg::vec3 position;
         rpcmsg::vec3 endPosition;
         uint32_t     nextDirectionChangeTimeMilliseconds;
         uint32_t     lastAttackTimeMilliseconds;
-        MSGPACK_DEFINE_ARRAY(id, alive, health, animationCycle, direction, position, 
+        MSGPACK_DEFINE_ARRAY(entityID, id, alive, health, animationCycle, direction, position, 
             endPosition, nextDirectionChangeTimeMilliseconds, lastAttackTimeMilliseconds);
     };
 
     // RPC message that holds data about how to display combo text
     struct MultiplierDisplayData {
+        uint32_t     entityID;
         uint32_t     multiplier;
         rpcmsg::mat4 pose;
         float        opacity;
-        MSGPACK_DEFINE_ARRAY(multiplier, pose, opacity);
+        MSGPACK_DEFINE_ARRAY(entityID, multiplier, pose, opacity);
     };
 
     // RPC message that holds the current game state
@@ -123,19 +220,78 @@ namespace rpcmsg {
         bool     rightTowerReady;
         uint32_t enemyDiedCue;
         uint32_t scoreMultiplier;
+        uint64_t serverTimeMilliseconds;
         std::list<rpcmsg::CastleCrasherData> castleCrasherData;
         std::list<rpcmsg::ArrowData> flyingArrows;
         std::list<rpcmsg::MultiplierDisplayData> multiplierDisplayData;
         MSGPACK_DEFINE_ARRAY(gameStarted, gameScore, castleHealth, leftTowerReady, 
-            rightTowerReady, enemyDiedCue, scoreMultiplier, castleCrasherData, 
+            rightTowerReady, enemyDiedCue, scoreMultiplier, serverTimeMilliseconds, castleCrasherData, 
             flyingArrows, multiplierDisplayData);
     };
 
-    // RPC message that holds a copy of the entire game state
+    // RPC message that holds a copy of the entire game state and the server tick it was
+    // published at (0 before the first tick)
     struct GameData {
+        uint64_t tick = 0;
         std::unordered_map<uint32_t, rpcmsg::PlayerData> playerData;
         rpcmsg::GameState gameState;
-        MSGPACK_DEFINE_ARRAY(playerData, gameState);
+        MSGPACK_DEFINE_ARRAY(tick, playerData, gameState);
+    };
+
+    // Already packed GameData, shared between everyone sending the same tick. Goes over
+    // the wire as a msgpack bin that the receiver unpacks as GameData. Without a buffer
+    // it goes out as an empty bin, which means there is nothing new to send
+    struct SerializedGameData {
+        std::shared_ptr<const std::vector<char>> buffer;
+    };
+
+    // Answer to REQUEST_SERVER_SESSION. The token is only ever handed out here, over the
+    // RPC connection, and proves the sender owns the session on channels that carry no
+    // connection of their own (input datagrams, snapshot streams)
+    struct SessionGrant {
+        uint32_t playerID;
+        uint64_t sessionToken;
+        MSGPACK_DEFINE_ARRAY(playerID, sessionToken);
+    };
+
+    // First frame a client sends on the snapshot stream. The server then pushes a
+    // GameDataDelta frame against the previous one up to snapshotRate times a second
+    struct SnapshotSubscription {
+        uint32_t playerID;
+        uint32_t snapshotRate;
+        uint32_t snapshotByteBudget = 0;    // 0 for no limit
+        uint64_t sessionToken = 0;          // From SessionGrant
+        MSGPACK_DEFINE_ARRAY(playerID, snapshotRate, snapshotByteBudget, sessionToken);
+    };
+
+    // Snapshot rate the server settled on for a client. Snapshots are pushed on the
+    // published ticks that are a multiple of tickInterval, publishRate / tickInterval
+    // times a second
+    struct SnapshotSchedule {
+        uint32_t publishRate;
+        uint32_t tickInterval;
+        MSGPACK_DEFINE_ARRAY(publishRate, tickInterval);
+    };
+
+    // Frame the server sends on the snapshot stream about the stream itself. It packs as
+    // a map, which is how it is told apart from the GameDataDelta arrays
+    #define STREAM_CONTROL_SESSION_CLOSED 1
+
+    struct StreamControl {
+        uint32_t code;
+        MSGPACK_DEFINE_MAP(code);
+    };
+
+    // Position quantized to 16 bits per axis within the wire position range (~4mm steps)
+    struct QuantizedPosition {
+        uint16_t x, y, z;
+    };
+
+    // Rigid pose as a quantized position and a smallest-three quaternion: 2 bits for the
+    // index of the largest component (left out), then 10 bits for each of the other three
+    struct QuantizedPose {
+        rpcmsg::QuantizedPosition position;
+        uint32_t                  rotation;
     };
 
     // Convert glm::vec2 over to an RPC message
@@ -161,6 +317,124 @@ namespace rpcmsg {
 
     // Convert the RPC message's version of glm::mat4 back to glm::mat4
     glm::mat4 rpcToGLM(const rpcmsg::mat4 & data);
+
+    // Quantize a position for the wire. Positions outside the wire range are clamped
+    rpcmsg::QuantizedPosition quantizePosition(const rpcmsg::vec3 & data);
+
+    // Convert a quantized position back to a vec3
+    rpcmsg::vec3 dequantizePosition(const rpcmsg::QuantizedPosition & data);
+
+    // Quantize a rigid pose (rotation and translation only) for the wire
+    rpcmsg::QuantizedPose quantizePose(const rpcmsg::mat4 & data);
+
+    // Convert a quantized pose back to a mat4
+    rpcmsg::mat4 dequantizePose(const rpcmsg::QuantizedPose & data);
+
+    // Quantize a non-negative value to a byte with the given number of steps per unit
+    uint8_t quantizeFixedPoint(float data, float scale);
+
+    // Convert a fixed point byte back to a float
+    float dequantizeFixedPoint(uint8_t data, float scale);
+
+    // Quantize the heading of a direction on the ground (XZ plane) to a byte
+    uint8_t quantizeHeading(const rpcmsg::vec3 & data);
+
+    // Convert a quantized heading back to a unit direction on the ground
+    rpcmsg::vec3 dequantizeHeading(uint8_t data);
+
+    // Where the castle crasher is in its walk cycle (degrees) at the given server time. It
+    // only depends on the time, so clients work it out rather than having it sent each tick
+    float getAnimationCycle(const rpcmsg::CastleCrasherData & data, uint64_t serverTimeMilliseconds);
+}
+
+namespace clmdep_msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+    // Point the bin straight at the shared buffer instead of copying it into the zone.
+    // The zone holds on to the buffer until the response has been written out
+    template <>
+    struct object_with_zone<rpcmsg::SerializedGameData> {
+        static void releaseBuffer(void * buffer) {
+            delete static_cast<std::shared_ptr<const std::vector<char>> *>(buffer);
+        }
+
+        void operator()(clmdep_msgpack::object::with_zone & o, const rpcmsg::SerializedGameData & v) const {
+            o.type = clmdep_msgpack::type::BIN;
+            o.via.bin.size = v.buffer ? checked_get_container_size(v.buffer->size()) : 0;
+            o.via.bin.ptr = v.buffer ? v.buffer->data() : nullptr;
+            if (v.buffer)
+                o.zone.push_finalizer(&releaseBuffer, new std::shared_ptr<const std::vector<char>>(v.buffer));
+        }
+    };
+
+    // Quantized positions and poses go out as small fixed size bins (little endian)
+    template <>
+    struct pack<rpcmsg::QuantizedPosition> {
+        template <typename Stream>
+        clmdep_msgpack::packer<Stream> & operator()(clmdep_msgpack::packer<Stream> & o, const rpcmsg::QuantizedPosition & v) const {
+            const char bytes[6] = { (char)(v.x & 0xFF), (char)(v.x >> 8), (char)(v.y & 0xFF),
+                (char)(v.y >> 8), (char)(v.z & 0xFF), (char)(v.z >> 8) };
+            o.pack_bin(sizeof(bytes));
+            o.pack_bin_body(bytes, sizeof(bytes));
+            return o;
+        }
+    };
+
+    template <>
+    struct convert<rpcmsg::QuantizedPosition> {
+        const clmdep_msgpack::object & operator()(const clmdep_msgpack::object & o, rpcmsg::QuantizedPosition & v) const {
+            if ((o.type != clmdep_msgpack::type::BIN) || (o.via.bin.size != 6))
+                throw clmdep_msgpack::type_error();
+            const uint8_t * bytes = reinterpret_cast<const uint8_t *>(o.via.bin.ptr);
+            v.x = (uint16_t)(bytes[0] | (bytes[1] << 8));
+            v.y = (uint16_t)(bytes[2] | (bytes[3] << 8));
+            v.z = (uint16_t)(bytes[4] | (bytes[5] << 8));
+            return o;
+        }
+    };
+
+    template <>
+    struct pack<rpcmsg::QuantizedPose> {
+        template <typename Stream>
+        clmdep_msgpack::packer<Stream> & operator()(clmdep_msgpack::packer<Stream> & o, const rpcmsg::QuantizedPose & v) const {
+            const char bytes[10] = { (char)(v.position.x & 0xFF), (char)(v.position.x >> 8),
+                (char)(v.position.y & 0xFF), (char)(v.position.y >> 8), (char)(v.position.z & 0xFF),
+                (char)(v.position.z >> 8), (char)(v.rotation & 0xFF), (char)((v.rotation >> 8) & 0xFF),
+                (char)((v.rotation >> 16) & 0xFF), (char)(v.rotation >> 24) };
+            o.pack_bin(sizeof(bytes));
+            o.pack_bin_body(bytes, sizeof(bytes));
+            return o;
+        }
+    };
+
+    template <>
+    struct convert<rpcmsg::QuantizedPose> {
+        const clmdep_msgpack::object & operator()(const clmdep_msgpack::object & o, rpcmsg::QuantizedPose & v) const {
+            if ((o.type != clmdep_msgpack::type::BIN) || (o.via.bin.size != 10))
+                throw clmdep_msgpack::type_error();
+            const uint8_t * bytes = reinterpret_cast<const uint8_t *>(o.via.bin.ptr);
+            v.position.x = (uint16_t)(bytes[0] | (bytes[1] << 8));
+            v.position.y = (uint16_t)(bytes[2] | (bytes[3] << 8));
+            v.position.z = (uint16_t)(bytes[4] | (bytes[5] << 8));
+            v.rotation = (uint32_t)bytes[6] | ((uint32_t)bytes[7] << 8) | ((uint32_t)bytes[8] << 16) | ((uint32_t)bytes[9] << 24);
+            return o;
+        }
+    };
+
+    template <>
+    struct pack<rpcmsg::SerializedGameData> {
+        template <typename Stream>
+        clmdep_msgpack::packer<Stream> & operator()(clmdep_msgpack::packer<Stream> & o, const rpcmsg::SerializedGameData & v) const {
+            uint32_t size = v.buffer ? checked_get_container_size(v.buffer->size()) : 0;
+            o.pack_bin(size);
+            if (size != 0)
+                o.pack_bin_body(v.buffer->data(), size);
+            return o;
+        }
+    };
+}
+}
 }
 
 #endif
\ No newline at end of file
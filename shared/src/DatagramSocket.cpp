@@ -0,0 +1,152 @@
+#include "DatagramSocket.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+static const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#define closeSocket closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+static const SocketHandle INVALID_SOCKET_HANDLE = -1;
+#define closeSocket ::close
+#endif
+
+// Winsock has to be started once per process before any socket is made
+static void initializeSockets()
+{
+#ifdef _WIN32
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+    });
+#endif
+}
+
+DatagramSocket::DatagramSocket() : lossGenerator(std::random_device()())
+{
+    initializeSockets();
+    this->socketHandle = INVALID_SOCKET_HANDLE;
+    this->lossProbability = 0.0f;
+}
+
+DatagramSocket::~DatagramSocket()
+{
+    this->close();
+}
+
+bool DatagramSocket::open(int portNumber)
+{
+    this->close();
+
+    SocketHandle handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (handle == INVALID_SOCKET_HANDLE)
+        return false;
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)portNumber);
+    if (bind(handle, (const sockaddr *)&address, sizeof(address)) != 0) {
+        closeSocket(handle);
+        return false;
+    }
+
+    // Wake up every so often so the receiving thread can notice when it should stop
+#ifdef _WIN32
+    DWORD receiveTimeout = DATAGRAM_RECEIVE_TIMEOUT_MS;
+#else
+    timeval receiveTimeout;
+    receiveTimeout.tv_sec = DATAGRAM_RECEIVE_TIMEOUT_MS / 1000;
+    receiveTimeout.tv_usec = (DATAGRAM_RECEIVE_TIMEOUT_MS % 1000) * 1000;
+#endif
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&receiveTimeout, sizeof(receiveTimeout));
+
+    this->socketHandle = handle;
+    return true;
+}
+
+bool DatagramSocket::resolve(const std::string & ipAddress, int portNumber, DatagramEndpoint & endpoint)
+{
+    initializeSockets();
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    addrinfo * addresses = nullptr;
+    if ((getaddrinfo(ipAddress.c_str(), std::to_string(portNumber).c_str(), &hints, &addresses) != 0) || (addresses == nullptr))
+        return false;
+
+    const sockaddr_in * address = (const sockaddr_in *)addresses->ai_addr;
+    endpoint.address = address->sin_addr.s_addr;
+    endpoint.port = address->sin_port;
+    freeaddrinfo(addresses);
+    return true;
+}
+
+bool DatagramSocket::sendTo(const DatagramEndpoint & endpoint, const char * data, size_t size)
+{
+    if ((!this->isOpen()) || (size > MAX_DATAGRAM_SIZE))
+        return false;
+
+    // Pretend the network lost it
+    if (this->lossProbability > 0.0f) {
+        std::lock_guard<std::mutex> lock(this->lossGeneratorLock);
+        if (std::uniform_real_distribution<float>(0.0f, 1.0f)(this->lossGenerator) < this->lossProbability)
+            return true;
+    }
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = endpoint.address;
+    address.sin_port = endpoint.port;
+    return sendto(this->socketHandle, data, (int)size, 0, (const sockaddr *)&address, sizeof(address)) == (int)size;
+}
+
+bool DatagramSocket::receiveFrom(std::vector<char> & datagram, DatagramEndpoint & endpoint)
+{
+    if (!this->isOpen())
+        return false;
+
+    sockaddr_in address;
+    socklen_t addressSize = sizeof(address);
+    datagram.resize(MAX_DATAGRAM_SIZE);
+    int received = recvfrom(this->socketHandle, datagram.data(), (int)datagram.size(), 0, (sockaddr *)&address, &addressSize);
+    if (received < 0) {
+        datagram.clear();
+        return false;
+    }
+
+    datagram.resize(received);
+    endpoint.address = address.sin_addr.s_addr;
+    endpoint.port = address.sin_port;
+    return true;
+}
+
+void DatagramSocket::setSimulatedLoss(float lossProbability)
+{
+    this->lossProbability = lossProbability;
+}
+
+bool DatagramSocket::isOpen() const
+{
+    return this->socketHandle != INVALID_SOCKET_HANDLE;
+}
+
+void DatagramSocket::close()
+{
+    SocketHandle handle = this->socketHandle.exchange(INVALID_SOCKET_HANDLE);
+    if (handle != INVALID_SOCKET_HANDLE)
+        closeSocket(handle);
+}
@@ -0,0 +1,380 @@
+#include "SharedMemoryRing.hpp"
+
+#include <new>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_RING_MAGIC 0x54445352    // "TDSR"
+#define INPUT_RING_MAGIC    0x54444952    // "TDIR"
+#define CACHE_LINE_SIZE     64
+
+static size_t alignToCacheLine(size_t size)
+{
+    return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+std::string getSnapshotRingName(int portNumber)
+{
+    return SHARED_MEMORY_NAME_PREFIX + std::to_string(portNumber) + "_snapshots";
+}
+
+std::string getInputRingName(int portNumber, uint32_t playerID)
+{
+    return SHARED_MEMORY_NAME_PREFIX + std::to_string(portNumber) + "_input_" + std::to_string(playerID);
+}
+
+SharedMemoryRegion::SharedMemoryRegion()
+{
+    this->address = nullptr;
+    this->regionSize = 0;
+    this->owner = false;
+#ifdef _WIN32
+    this->mappingHandle = nullptr;
+#endif
+}
+
+SharedMemoryRegion::~SharedMemoryRegion()
+{
+    this->close();
+}
+
+bool SharedMemoryRegion::create(const std::string & name, size_t size)
+{
+    this->close();
+#ifdef _WIN32
+    std::string mappingName = "Local\\" + name;
+    HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), mappingName.c_str());
+    if (handle == nullptr)
+        return false;
+    void * address = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (address == nullptr) {
+        CloseHandle(handle);
+        return false;
+    }
+    this->mappingHandle = handle;
+#else
+    std::string mappingName = "/" + name;
+    shm_unlink(mappingName.c_str());    // Left behind by a server that crashed
+    int handle = shm_open(mappingName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (handle < 0)
+        return false;
+    if (ftruncate(handle, (off_t)size) != 0) {
+        ::close(handle);
+        shm_unlink(mappingName.c_str());
+        return false;
+    }
+    void * address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    ::close(handle);
+    if (address == MAP_FAILED) {
+        shm_unlink(mappingName.c_str());
+        return false;
+    }
+#endif
+    std::memset(address, 0, size);
+    this->name = mappingName;
+    this->address = address;
+    this->regionSize = size;
+    this->owner = true;
+    return true;
+}
+
+bool SharedMemoryRegion::open(const std::string & name)
+{
+    this->close();
+#ifdef _WIN32
+    std::string mappingName = "Local\\" + name;
+    HANDLE handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mappingName.c_str());
+    if (handle == nullptr)
+        return false;
+    void * address = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION memoryInformation;
+    if ((address == nullptr) || (VirtualQuery(address, &memoryInformation, sizeof(memoryInformation)) == 0)) {
+        if (address != nullptr)
+            UnmapViewOfFile(address);
+        CloseHandle(handle);
+        return false;
+    }
+    this->mappingHandle = handle;
+    size_t size = memoryInformation.RegionSize;
+#else
+    std::string mappingName = "/" + name;
+    int handle = shm_open(mappingName.c_str(), O_RDWR, 0600);
+    if (handle < 0)
+        return false;
+    struct stat status;
+    if ((fstat(handle, &status) != 0) || (status.st_size == 0)) {
+        ::close(handle);
+        return false;
+    }
+    size_t size = (size_t)status.st_size;
+    void * address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    ::close(handle);
+    if (address == MAP_FAILED)
+        return false;
+#endif
+    this->name = mappingName;
+    this->address = address;
+    this->regionSize = size;
+    this->owner = false;
+    return true;
+}
+
+void * SharedMemoryRegion::data() const
+{
+    return this->address;
+}
+
+size_t SharedMemoryRegion::size() const
+{
+    return this->regionSize;
+}
+
+void SharedMemoryRegion::close()
+{
+    if (this->address == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(this->address);
+    CloseHandle(this->mappingHandle);
+    this->mappingHandle = nullptr;
+#else
+    munmap(this->address, this->regionSize);
+    if (this->owner)
+        shm_unlink(this->name.c_str());
+#endif
+    this->address = nullptr;
+    this->regionSize = 0;
+    this->owner = false;
+}
+
+// Ring layout: header, then slotCount slots of slotStride bytes each
+struct SnapshotRing::Header {
+    uint32_t magic;
+    uint32_t slotCount;
+    uint32_t slotStride;
+    uint32_t slotSize;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> publishedSequence;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> readerCount;
+};
+
+// A slot's sequence is 0 while the writer is filling it in
+struct SnapshotRing::Slot {
+    std::atomic<uint64_t> sequence;
+    uint32_t size;
+    alignas(CACHE_LINE_SIZE) char data[1];
+};
+
+SnapshotRing::SnapshotRing()
+{
+    this->header = nullptr;
+    this->lastReadSequence = 0;
+    this->reader = false;
+}
+
+SnapshotRing::~SnapshotRing()
+{
+    this->close();
+}
+
+SnapshotRing::Slot * SnapshotRing::getSlot(uint64_t sequence) const
+{
+    char * firstSlot = (char *)this->header + alignToCacheLine(sizeof(Header));
+    return (Slot *)(firstSlot + (sequence % this->header->slotCount) * this->header->slotStride);
+}
+
+bool SnapshotRing::create(const std::string & name)
+{
+    size_t slotStride = alignToCacheLine(offsetof(Slot, data) + SHARED_SNAPSHOT_SLOT_SIZE);
+    if (!this->region.create(name, alignToCacheLine(sizeof(Header)) + SHARED_SNAPSHOT_SLOT_COUNT * slotStride))
+        return false;
+
+    this->header = new (this->region.data()) Header();
+    this->header->slotCount = SHARED_SNAPSHOT_SLOT_COUNT;
+    this->header->slotStride = (uint32_t)slotStride;
+    this->header->slotSize = SHARED_SNAPSHOT_SLOT_SIZE;
+    this->header->publishedSequence = 0;
+    this->header->readerCount = 0;
+    for (uint64_t slot = 0; slot < SHARED_SNAPSHOT_SLOT_COUNT; slot++)
+        new (this->getSlot(slot)) Slot();
+    this->header->magic = SNAPSHOT_RING_MAGIC;
+    return true;
+}
+
+bool SnapshotRing::publish(const char * data, size_t size)
+{
+    if ((this->header == nullptr) || (size > this->header->slotSize))
+        return false;
+
+    uint64_t sequence = this->header->publishedSequence.load(std::memory_order_relaxed) + 1;
+    Slot * slot = this->getSlot(sequence);
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(slot->data, data, size);
+    slot->size = (uint32_t)size;
+    slot->sequence.store(sequence, std::memory_order_release);
+    this->header->publishedSequence.store(sequence, std::memory_order_release);
+    return true;
+}
+
+bool SnapshotRing::hasReaders() const
+{
+    return (this->header != nullptr) && (this->header->readerCount.load(std::memory_order_relaxed) > 0);
+}
+
+bool SnapshotRing::open(const std::string & name)
+{
+    if (!this->region.open(name))
+        return false;
+
+    this->header = (Header *)this->region.data();
+    size_t expectedSize = alignToCacheLine(sizeof(Header)) + (size_t)this->header->slotCount * this->header->slotStride;
+    if ((this->header->magic != SNAPSHOT_RING_MAGIC) || (this->header->slotCount == 0) || (this->region.size() < expectedSize)) {
+        this->close();
+        return false;
+    }
+    this->header->readerCount.fetch_add(1, std::memory_order_relaxed);
+    this->reader = true;
+    this->lastReadSequence = this->header->publishedSequence.load(std::memory_order_acquire);
+    return true;
+}
+
+bool SnapshotRing::readLatest(const std::function<void(const char *, size_t)> & consume)
+{
+    if (this->header == nullptr)
+        return false;
+
+    uint64_t sequence = this->header->publishedSequence.load(std::memory_order_acquire);
+    if (sequence == this->lastReadSequence)
+        return false;
+
+    Slot * slot = this->getSlot(sequence);
+    if ((slot->sequence.load(std::memory_order_acquire) != sequence) || (slot->size > this->header->slotSize))
+        return false;
+    consume(slot->data, slot->size);
+
+    // Make sure the writer didn't start on this slot while we were reading it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence.load(std::memory_order_relaxed) != sequence)
+        return false;
+    this->lastReadSequence = sequence;
+    return true;
+}
+
+void SnapshotRing::close()
+{
+    if (this->reader && (this->header != nullptr))
+        this->header->readerCount.fetch_sub(1, std::memory_order_relaxed);
+    this->reader = false;
+    this->region.close();
+    this->header = nullptr;
+}
+
+// Ring layout: header, then slotCount slots holding a size followed by the message. The
+// producer and consumer counters live on their own cache lines
+struct InputRing::Header {
+    uint32_t magic;
+    uint32_t slotCount;
+    uint32_t slotStride;
+    uint32_t slotSize;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;    // Messages pushed so far
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;    // Messages popped so far
+};
+
+InputRing::InputRing()
+{
+    this->header = nullptr;
+}
+
+char * InputRing::getSlot(uint64_t index) const
+{
+    char * firstSlot = (char *)this->header + alignToCacheLine(sizeof(Header));
+    return firstSlot + (index % this->header->slotCount) * this->header->slotStride;
+}
+
+bool InputRing::create(const std::string & name)
+{
+    size_t slotStride = alignToCacheLine(sizeof(uint32_t) + SHARED_INPUT_SLOT_SIZE);
+    if (!this->region.create(name, alignToCacheLine(sizeof(Header)) + SHARED_INPUT_SLOT_COUNT * slotStride))
+        return false;
+
+    this->header = new (this->region.data()) Header();
+    this->header->slotCount = SHARED_INPUT_SLOT_COUNT;
+    this->header->slotStride = (uint32_t)slotStride;
+    this->header->slotSize = SHARED_INPUT_SLOT_SIZE;
+    this->header->head = 0;
+    this->header->tail = 0;
+    this->header->magic = INPUT_RING_MAGIC;
+    return true;
+}
+
+bool InputRing::open(const std::string & name)
+{
+    if (!this->region.open(name))
+        return false;
+
+    this->header = (Header *)this->region.data();
+    size_t expectedSize = alignToCacheLine(sizeof(Header)) + (size_t)this->header->slotCount * this->header->slotStride;
+    if ((this->header->magic != INPUT_RING_MAGIC) || (this->header->slotCount == 0) || (this->region.size() < expectedSize)) {
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+bool InputRing::push(const char * data, size_t size)
+{
+    if ((this->header == nullptr) || (size > this->header->slotSize))
+        return false;
+
+    uint64_t head = this->header->head.load(std::memory_order_relaxed);
+    if (head - this->header->tail.load(std::memory_order_acquire) >= this->header->slotCount)
+        return false;
+
+    char * slot = this->getSlot(head);
+    uint32_t messageSize = (uint32_t)size;
+    std::memcpy(slot, &messageSize, sizeof(messageSize));
+    std::memcpy(slot + sizeof(messageSize), data, size);
+    this->header->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool InputRing::pop(std::vector<char> & message)
+{
+    if (this->header == nullptr)
+        return false;
+
+    uint64_t tail = this->header->tail.load(std::memory_order_relaxed);
+    if (tail == this->header->head.load(std::memory_order_acquire))
+        return false;
+
+    // The producer lives in another process, so don't trust the size it wrote
+    const char * slot = this->getSlot(tail);
+    uint32_t messageSize;
+    std::memcpy(&messageSize, slot, sizeof(messageSize));
+    if (messageSize > this->header->slotSize)
+        messageSize = 0;
+    message.assign(slot + sizeof(messageSize), slot + sizeof(messageSize) + messageSize);
+    this->header->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void InputRing::close()
+{
+    this->region.close();
+    this->header = nullptr;
+}
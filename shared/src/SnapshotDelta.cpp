@@ -0,0 +1,119 @@
+#include "SnapshotDelta.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+// Compare a list of entities keyed by entityID against the baseline list
+template <typename T>
+static void diffEntities(const std::list<T> * baseline, const std::list<T> & current,
+    std::vector<uint32_t> & removed, std::vector<rpcmsg::EntityDelta<T>> & changed)
+{
+    std::unordered_map<uint32_t, const T *> baselineEntities;
+    if (baseline != nullptr)
+        for (auto entity = baseline->begin(); entity != baseline->end(); entity++)
+            baselineEntities[entity->entityID] = &(*entity);
+
+    for (auto entity = current.begin(); entity != current.end(); entity++) {
+        auto baselineEntity = baselineEntities.find(entity->entityID);
+        uint32_t fieldMask = (baselineEntity == baselineEntities.end()) ?
+            rpcmsg::allFields<T>() : rpcmsg::diffFields(*baselineEntity->second, *entity);
+        if (baselineEntity != baselineEntities.end())
+            baselineEntities.erase(baselineEntity);
+        if (fieldMask != 0)
+            changed.push_back({ entity->entityID, fieldMask, *entity });
+    }
+
+    // Whatever is left over is gone now
+    for (auto entity = baselineEntities.begin(); entity != baselineEntities.end(); entity++)
+        removed.push_back(entity->first);
+}
+
+// Apply removals and changes to a list of entities keyed by entityID. New entities go to the back
+template <typename T>
+static void applyEntities(const std::vector<uint32_t> & removed,
+    const std::vector<rpcmsg::EntityDelta<T>> & changed, std::list<T> & entities)
+{
+    std::unordered_set<uint32_t> removedEntities(removed.begin(), removed.end());
+    std::unordered_map<uint32_t, T *> existingEntities;
+    for (auto entity = entities.begin(); entity != entities.end();) {
+        if (removedEntities.count(entity->entityID) != 0)
+            entity = entities.erase(entity);
+        else {
+            existingEntities[entity->entityID] = &(*entity);
+            entity++;
+        }
+    }
+
+    for (auto delta = changed.begin(); delta != changed.end(); delta++) {
+        auto existingEntity = existingEntities.find(delta->entityID);
+        if (existingEntity != existingEntities.end())
+            rpcmsg::copyFields(delta->fieldMask, delta->data, *existingEntity->second);
+        else {
+            T newEntity = T();
+            rpcmsg::copyFields(delta->fieldMask, delta->data, newEntity);
+            newEntity.entityID = delta->entityID;
+            entities.push_back(newEntity);
+        }
+    }
+}
+
+// Describe how to get from the baseline to the current game data
+rpcmsg::GameDataDelta rpcmsg::makeGameDataDelta(const rpcmsg::GameData * baseline, uint64_t baselineTick,
+    const rpcmsg::GameData & current, uint64_t tick)
+{
+    rpcmsg::GameDataDelta delta;
+    delta.tick = tick;
+    delta.baselineTick = (baseline != nullptr) ? baselineTick : 0;
+
+    // Game state (lists are handled as entities below)
+    delta.gameState.entityID = 0;
+    delta.gameState.fieldMask = (baseline != nullptr) ?
+        rpcmsg::diffFields(baseline->gameState, current.gameState) : rpcmsg::allFields<rpcmsg::GameState>();
+    rpcmsg::copyFields(delta.gameState.fieldMask, current.gameState, delta.gameState.data);
+
+    // Players are keyed by their player ID
+    for (auto player = current.playerData.begin(); player != current.playerData.end(); player++) {
+        uint32_t fieldMask = rpcmsg::allFields<rpcmsg::PlayerData>();
+        if (baseline != nullptr) {
+            auto baselinePlayer = baseline->playerData.find(player->first);
+            if (baselinePlayer != baseline->playerData.end())
+                fieldMask = rpcmsg::diffFields(baselinePlayer->second, player->second);
+        }
+        if (fieldMask != 0)
+            delta.changedPlayers.push_back({ player->first, fieldMask, player->second });
+    }
+    if (baseline != nullptr)
+        for (auto player = baseline->playerData.begin(); player != baseline->playerData.end(); player++)
+            if (current.playerData.find(player->first) == current.playerData.end())
+                delta.removedPlayers.push_back(player->first);
+
+    const rpcmsg::GameState * baselineGameState = (baseline != nullptr) ? &baseline->gameState : nullptr;
+    diffEntities(baselineGameState ? &baselineGameState->castleCrasherData : nullptr, current.gameState.castleCrasherData,
+        delta.removedCastleCrashers, delta.changedCastleCrashers);
+    diffEntities(baselineGameState ? &baselineGameState->flyingArrows : nullptr, current.gameState.flyingArrows,
+        delta.removedFlyingArrows, delta.changedFlyingArrows);
+    diffEntities(baselineGameState ? &baselineGameState->multiplierDisplayData : nullptr, current.gameState.multiplierDisplayData,
+        delta.removedMultiplierDisplays, delta.changedMultiplierDisplays);
+
+    return delta;
+}
+
+// Bring game data at the delta's baseline tick up to the delta's tick. A full snapshot
+// starts over from empty game data
+void rpcmsg::applyGameDataDelta(const rpcmsg::GameDataDelta & delta, rpcmsg::GameData & gameData)
+{
+    if (delta.baselineTick == 0)
+        gameData = rpcmsg::GameData();
+    gameData.tick = delta.tick;
+
+    rpcmsg::copyFields(delta.gameState.fieldMask, delta.gameState.data, gameData.gameState);
+
+    for (auto playerID = delta.removedPlayers.begin(); playerID != delta.removedPlayers.end(); playerID++)
+        gameData.playerData.erase(*playerID);
+    for (auto player = delta.changedPlayers.begin(); player != delta.changedPlayers.end(); player++)
+        rpcmsg::copyFields(player->fieldMask, player->data, gameData.playerData[player->entityID]);
+
+    applyEntities(delta.removedCastleCrashers, delta.changedCastleCrashers, gameData.gameState.castleCrasherData);
+    applyEntities(delta.removedFlyingArrows, delta.changedFlyingArrows, gameData.gameState.flyingArrows);
+    applyEntities(delta.removedMultiplierDisplays, delta.changedMultiplierDisplays, gameData.gameState.multiplierDisplayData);
+}
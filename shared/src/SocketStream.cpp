@@ -0,0 +1,227 @@
+#include "SocketStream.hpp"
+
+#include <mutex>
+#include <cstring>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+static const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#define closeSocket closesocket
+#define SEND_FLAGS 0
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+static const SocketHandle INVALID_SOCKET_HANDLE = -1;
+#define closeSocket ::close
+#define SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+// Winsock has to be started once per process before any socket is made
+static void initializeSockets()
+{
+#ifdef _WIN32
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+    });
+#endif
+}
+
+// Shutting a socket down first wakes up any thread blocked on it
+static void shutdownAndClose(std::atomic<SocketHandle> & socketHandle)
+{
+    SocketHandle handle = socketHandle.exchange(INVALID_SOCKET_HANDLE);
+    if (handle == INVALID_SOCKET_HANDLE)
+        return;
+#ifdef _WIN32
+    shutdown(handle, SD_BOTH);
+#else
+    shutdown(handle, SHUT_RDWR);
+#endif
+    closeSocket(handle);
+}
+
+SocketStream::SocketStream()
+{
+    initializeSockets();
+    this->socketHandle = INVALID_SOCKET_HANDLE;
+}
+
+SocketStream::SocketStream(SocketHandle socketHandle)
+{
+    initializeSockets();
+    this->socketHandle = socketHandle;
+
+    // Snapshots are small and latency matters more than packing them together
+    int noDelay = 1;
+    setsockopt(socketHandle, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+}
+
+SocketStream::~SocketStream()
+{
+    this->close();
+}
+
+bool SocketStream::connect(const std::string & ipAddress, int portNumber)
+{
+    this->close();
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    addrinfo * addresses = nullptr;
+    if (getaddrinfo(ipAddress.c_str(), std::to_string(portNumber).c_str(), &hints, &addresses) != 0)
+        return false;
+
+    // Take the first address that accepts the connection
+    SocketHandle handle = INVALID_SOCKET_HANDLE;
+    for (addrinfo * address = addresses; address != nullptr; address = address->ai_next) {
+        handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (handle == INVALID_SOCKET_HANDLE)
+            continue;
+        if (::connect(handle, address->ai_addr, (int)address->ai_addrlen) == 0)
+            break;
+        closeSocket(handle);
+        handle = INVALID_SOCKET_HANDLE;
+    }
+    freeaddrinfo(addresses);
+    if (handle == INVALID_SOCKET_HANDLE)
+        return false;
+
+    int noDelay = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+    this->socketHandle = handle;
+    return true;
+}
+
+bool SocketStream::sendAll(const char * data, size_t size)
+{
+    while (size > 0) {
+        int sent = send(this->socketHandle, data, (int)size, SEND_FLAGS);
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool SocketStream::receiveAll(char * data, size_t size)
+{
+    while (size > 0) {
+        int received = recv(this->socketHandle, data, (int)size, 0);
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool SocketStream::sendFrame(const char * data, size_t size)
+{
+    if ((!this->isOpen()) || (size > MAX_FRAME_SIZE))
+        return false;
+
+    uint32_t frameSize = (uint32_t)size;
+    char header[4] = { (char)(frameSize & 0xFF), (char)((frameSize >> 8) & 0xFF),
+        (char)((frameSize >> 16) & 0xFF), (char)((frameSize >> 24) & 0xFF) };
+    return this->sendAll(header, sizeof(header)) && this->sendAll(data, size);
+}
+
+bool SocketStream::receiveFrame(std::vector<char> & frame)
+{
+    unsigned char header[4];
+    if ((!this->isOpen()) || (!this->receiveAll((char *)header, sizeof(header))))
+        return false;
+
+    // Anything bigger than this is a broken or hostile peer
+    uint32_t frameSize = (uint32_t)header[0] | ((uint32_t)header[1] << 8) |
+        ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+    if (frameSize > MAX_FRAME_SIZE)
+        return false;
+
+    frame.resize(frameSize);
+    return (frameSize == 0) || this->receiveAll(frame.data(), frameSize);
+}
+
+bool SocketStream::isOpen() const
+{
+    return this->socketHandle != INVALID_SOCKET_HANDLE;
+}
+
+void SocketStream::setSendBufferSize(int bytes)
+{
+    setsockopt(this->socketHandle, SOL_SOCKET, SO_SNDBUF, (const char *)&bytes, sizeof(bytes));
+}
+
+void SocketStream::close()
+{
+    shutdownAndClose(this->socketHandle);
+}
+
+SocketListener::SocketListener()
+{
+    initializeSockets();
+    this->socketHandle = INVALID_SOCKET_HANDLE;
+}
+
+SocketListener::~SocketListener()
+{
+    this->close();
+}
+
+bool SocketListener::listen(int portNumber)
+{
+    this->close();
+
+    SocketHandle handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (handle == INVALID_SOCKET_HANDLE)
+        return false;
+
+    int reuseAddress = 1;
+    setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuseAddress, sizeof(reuseAddress));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)portNumber);
+    if ((bind(handle, (const sockaddr *)&address, sizeof(address)) != 0) || (::listen(handle, SOMAXCONN) != 0)) {
+        closeSocket(handle);
+        return false;
+    }
+
+    this->socketHandle = handle;
+    return true;
+}
+
+std::unique_ptr<SocketStream> SocketListener::accept()
+{
+    SocketHandle listenHandle = this->socketHandle;
+    if (listenHandle == INVALID_SOCKET_HANDLE)
+        return nullptr;
+
+    SocketHandle handle = ::accept(listenHandle, nullptr, nullptr);
+    if (handle == INVALID_SOCKET_HANDLE)
+        return nullptr;
+    return std::make_unique<SocketStream>(handle);
+}
+
+bool SocketListener::isOpen() const
+{
+    return this->socketHandle != INVALID_SOCKET_HANDLE;
+}
+
+void SocketListener::close()
+{
+    shutdownAndClose(this->socketHandle);
+}
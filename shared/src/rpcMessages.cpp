@@ -1,5 +1,7 @@
 #include "rpcMessages.hpp"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 // Convert glm::vec2 over to an RPC message
 rpcmsg::vec2 rpcmsg::glmToRPC(const glm::vec2 & data) {
@@ -57,4 +59,111 @@ glm::mat4 rpcmsg::rpcToGLM(const rpcmsg::mat4 & data) {
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+static const float SQRT_2 = 1.41421356237f;
+
+// Map a position axis onto the full 16 bit range
+static uint16_t quantizeAxis(float data) {
+    float normalized = (data - WIRE_POSITION_MIN) / (WIRE_POSITION_MAX - WIRE_POSITION_MIN);
+    normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+    return (uint16_t)std::lround(normalized * 65535.0f);
+}
+
+static float dequantizeAxis(uint16_t data) {
+    return WIRE_POSITION_MIN + ((float)data / 65535.0f) * (WIRE_POSITION_MAX - WIRE_POSITION_MIN);
+}
+
+// Quantize a position for the wire. Positions outside the wire range are clamped
+rpcmsg::QuantizedPosition rpcmsg::quantizePosition(const rpcmsg::vec3 & data) {
+    return rpcmsg::QuantizedPosition{ quantizeAxis(data.x), quantizeAxis(data.y), quantizeAxis(data.z) };
+}
+
+// Convert a quantized position back to a vec3
+rpcmsg::vec3 rpcmsg::dequantizePosition(const rpcmsg::QuantizedPosition & data) {
+    return rpcmsg::vec3{ dequantizeAxis(data.x), dequantizeAxis(data.y), dequantizeAxis(data.z) };
+}
+
+// Quantize a rigid pose (rotation and translation only) for the wire
+rpcmsg::QuantizedPose rpcmsg::quantizePose(const rpcmsg::mat4 & data) {
+    glm::mat4 pose = rpcmsg::rpcToGLM(data);
+    glm::quat rotation = glm::quat_cast(glm::mat3(pose));
+    float components[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+
+    // Leave out the largest component, it can be rebuilt from the other three. Flipping
+    // the sign of the whole quaternion keeps it positive without changing the rotation
+    int largest = 0;
+    for (int component = 1; component < 4; component++)
+        if (std::abs(components[component]) > std::abs(components[largest]))
+            largest = component;
+    float sign = (components[largest] < 0.0f) ? -1.0f : 1.0f;
+
+    // The other three are within +/- 1/sqrt(2)
+    uint32_t packedRotation = (uint32_t)largest << 30;
+    int shift = 20;
+    for (int component = 0; component < 4; component++) {
+        if (component == largest)
+            continue;
+        float normalized = (components[component] * sign * SQRT_2 + 1.0f) * 0.5f;
+        normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+        packedRotation |= (uint32_t)std::lround(normalized * 1023.0f) << shift;
+        shift -= 10;
+    }
+
+    rpcmsg::QuantizedPose result;
+    result.position = rpcmsg::quantizePosition(rpcmsg::glmToRPC(glm::vec3(pose[3])));
+    result.rotation = packedRotation;
+    return result;
+}
+
+// Convert a quantized pose back to a mat4
+rpcmsg::mat4 rpcmsg::dequantizePose(const rpcmsg::QuantizedPose & data) {
+    int largest = (int)(data.rotation >> 30);
+    float components[4];
+    float sumOfSquares = 0.0f;
+    int shift = 20;
+    for (int component = 0; component < 4; component++) {
+        if (component == largest)
+            continue;
+        float normalized = (float)((data.rotation >> shift) & 0x3FF) / 1023.0f;
+        components[component] = (normalized * 2.0f - 1.0f) / SQRT_2;
+        sumOfSquares += components[component] * components[component];
+        shift -= 10;
+    }
+    components[largest] = std::sqrt(std::max(1.0f - sumOfSquares, 0.0f));
+
+    glm::quat rotation = glm::normalize(glm::quat(components[3], components[0], components[1], components[2]));
+    glm::mat4 pose = glm::mat4_cast(rotation);
+    pose[3] = glm::vec4(rpcmsg::rpcToGLM(rpcmsg::dequantizePosition(data.position)), 1.0f);
+    return rpcmsg::glmToRPC(pose);
+}
+
+// Quantize a non-negative value to a byte with the given number of steps per unit
+uint8_t rpcmsg::quantizeFixedPoint(float data, float scale) {
+    return (uint8_t)std::min(std::max(std::lround(data * scale), 0L), 255L);
+}
+
+// Convert a fixed point byte back to a float
+float rpcmsg::dequantizeFixedPoint(uint8_t data, float scale) {
+    return (float)data / scale;
+}
+
+static const float TWO_PI = 6.28318530718f;
+
+// Quantize the heading of a direction on the ground (XZ plane) to a byte
+uint8_t rpcmsg::quantizeHeading(const rpcmsg::vec3 & data) {
+    long step = std::lround(std::atan2(data.x, data.z) / TWO_PI * WIRE_HEADING_STEPS);
+    return (uint8_t)(((step % WIRE_HEADING_STEPS) + WIRE_HEADING_STEPS) % WIRE_HEADING_STEPS);
+}
+
+// Convert a quantized heading back to a unit direction on the ground
+rpcmsg::vec3 rpcmsg::dequantizeHeading(uint8_t data) {
+    float angle = (float)(data % WIRE_HEADING_STEPS) / WIRE_HEADING_STEPS * TWO_PI;
+    return rpcmsg::vec3{ std::sin(angle), 0.0f, std::cos(angle) };
+}
+
+// Where the castle crasher is in its walk cycle (degrees) at the given server time
+float rpcmsg::getAnimationCycle(const rpcmsg::CastleCrasherData & data, uint64_t serverTimeMilliseconds) {
+    float cycle = (float)(serverTimeMilliseconds % CASTLE_CRASHER_ANIMATION_MILLISECONDS) / CASTLE_CRASHER_ANIMATION_MILLISECONDS;
+    return std::fmod(data.animationCycle + cycle * 360.0f, 360.0f);
+}